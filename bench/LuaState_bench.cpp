@@ -0,0 +1,172 @@
+//
+//  LuaState_bench.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+//
+//  Microbenchmarks of common LuaState operations. Results are printed as CSV with time and number of allocations per
+//  operation, so they can be compared between releases. Heap allocations are counted by replaced global operator new,
+//  allocations of Lua state by its allocator.
+//
+//  Usage: LuaState_bench [iterations]
+
+#include "../include/LuaState.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Number of allocations made with global operator new
+static std::size_t heapAllocations = 0;
+
+void* operator new(std::size_t size)
+{
+    ++heapAllocations;
+    if (void* memory = std::malloc(size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Allocator of Lua state which counts requested blocks
+class CountingAllocator : public lua::BaseAllocator
+{
+public:
+
+    std::size_t allocations = 0;
+
+    void* reallocate(void* ptr, std::size_t oldSize, std::size_t newSize) noexcept override
+    {
+        if (newSize == 0)
+        {
+            std::free(ptr);
+            return nullptr;
+        }
+
+        if (newSize > oldSize)
+            ++allocations;
+        return std::realloc(ptr, newSize);
+    }
+};
+
+/// Results are written here, so compiler can't remove benchmarked code
+static volatile lua::Integer sink = 0;
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Runs body given number of times after short warm up and prints one CSV line
+///
+/// @param name         Name of benchmark
+/// @param iterations   Number of operations
+/// @param allocator    Allocator of benchmarked Lua state
+/// @param body         Function with benchmarked operations
+/// @param batch        Number of operations made by one call of body
+template<typename F>
+void run(const char* name, std::size_t iterations, const CountingAllocator& allocator, F&& body, std::size_t batch = 1)
+{
+    iterations = (iterations + batch - 1) / batch;
+
+    for (std::size_t i = 0; i < iterations / 10 + 1; ++i)
+        body();
+
+    std::size_t heapBefore = heapAllocations;
+    std::size_t luaBefore = allocator.allocations;
+    auto start = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0; i < iterations; ++i)
+        body();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    double count = static_cast<double>(iterations * batch);
+
+    std::printf("%s,%zu,%.2f,%.3f,%.3f\n", name, iterations * batch,
+                static_cast<double>(elapsed.count()) / count,
+                static_cast<double>(heapAllocations - heapBefore) / count,
+                static_cast<double>(allocator.allocations - luaBefore) / count);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    std::size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    CountingAllocator* allocator = new CountingAllocator();
+    lua::State state{ std::unique_ptr<lua::BaseAllocator>(allocator) };
+
+    state.doString("number = 42\n"
+                   "text = 'The quick brown fox jumps over the lazy dog'\n"
+                   "table = { nested = { value = 7 } }\n"
+                   "function call0() return 1 end\n"
+                   "function call1(a) return a end\n"
+                   "function call4(a, b, c, d) return a + b + c + d end\n"
+                   "function multi() return 1, 2, 3 end\n");
+
+    state.set("bound", [](lua::Integer a, lua::Integer b, lua::Integer c, lua::Integer d) { return a + b + c + d; });
+
+    // Lua loop calls bound function, so it measures only Lua to C++ calls
+    lua::Chunk boundLoop = state.compile("local bound = bound\n"
+                                         "for i = 1, 1000 do bound(i, 2, 3, 4) end\n");
+
+    std::string text = "The quick brown fox jumps over the lazy dog";
+
+    std::printf("benchmark,iterations,ns_per_op,heap_allocs_per_op,lua_allocs_per_op\n");
+
+    run("global_get", iterations, *allocator, [&]() {
+        sink = state["number"].toInt();
+    });
+
+    lua::Integer counter = 0;
+    run("global_set", iterations, *allocator, [&]() {
+        state.set("number", ++counter);
+    });
+
+    run("nested_read", iterations, *allocator, [&]() {
+        sink = state["table"]["nested"]["value"].toInt();
+    });
+
+    run("call_lua_0_args", iterations, *allocator, [&]() {
+        sink = state["call0"]().toInt();
+    });
+
+    run("call_lua_1_arg", iterations, *allocator, [&]() {
+        sink = state["call1"](1).toInt();
+    });
+
+    run("call_lua_4_args", iterations, *allocator, [&]() {
+        sink = state["call4"](1, 2, 3, 4).toInt();
+    });
+
+    run("call_cpp_4_args", iterations, *allocator, [&]() {
+        boundLoop();
+    }, 1000);
+
+    run("tie_3_returns", iterations, *allocator, [&]() {
+        lua::Integer a, b, c;
+        lua::tie(a, b, c) = state["multi"]();
+        sink = a + b + c;
+    });
+
+    run("value_reference_round_trip", iterations, *allocator, [&]() {
+        lua::ValueReference reference(state["table"]);
+        sink = reference.unref()["nested"]["value"].toInt();
+    });
+
+    run("string_marshalling", iterations, *allocator, [&]() {
+        state.setString("text", text);
+        sink = static_cast<lua::Integer>(state["text"].toString().size());
+    });
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+//
+//  dealloc_bench.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+//
+//  Compares detail::DeallocQueue with previous std::priority_queue implementation. We simulate stack of lua::Value
+//  instances, which are destroyed in random order, same way as detail::StackItem destructor does it.
+
+#include "../include/LuaStackItem.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+struct PriorityOrder
+{
+    bool operator()(const lua::detail::DeallocStackItem& lhs, const lua::detail::DeallocStackItem& rhs) const
+    {
+        return lhs.end < rhs.end;
+    }
+};
+
+/// Previous implementation of deallocation queue
+class PriorityDeallocQueue
+{
+    std::priority_queue<lua::detail::DeallocStackItem, std::vector<lua::detail::DeallocStackItem>, PriorityOrder> m_queue;
+
+public:
+
+    void push(const lua::detail::DeallocStackItem& item)
+    {
+        m_queue.push(item);
+    }
+
+    int reclaim(int top)
+    {
+        while (!m_queue.empty() && m_queue.top().end == top)
+        {
+            top -= m_queue.top().size;
+            m_queue.pop();
+        }
+        return top;
+    }
+
+    bool empty() const
+    {
+        return m_queue.empty();
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+struct SimulatedValue
+{
+    int top;
+    int pushed;
+};
+
+/// Creates values on simulated stack and destroys them in given order
+///
+/// @return Nanoseconds per destroyed value
+template<typename Queue>
+double destroyValues(const std::vector<SimulatedValue>& values, const std::vector<std::size_t>& order, int repetitions)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int repetition = 0; repetition < repetitions; ++repetition)
+    {
+        Queue queue;
+        int stackTop = values.back().top + values.back().pushed;
+
+        for (std::size_t index : order)
+        {
+            const SimulatedValue& value = values[index];
+            if (stackTop < value.top + value.pushed)
+                continue;
+
+            if (value.top + value.pushed == stackTop)
+                stackTop = queue.reclaim(value.top);
+            else
+                queue.push(lua::detail::DeallocStackItem(value.top, value.pushed));
+        }
+
+        if (stackTop != 0 || !queue.empty())
+        {
+            std::printf("error: stack was not cleaned\n");
+            std::exit(1);
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return static_cast<double>(elapsed.count()) / (static_cast<double>(values.size()) * repetitions);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> slots(1, 3);
+
+    std::printf("values,priority_queue_ns,dealloc_queue_ns,speedup\n");
+
+    for (std::size_t count : { 16, 64, 256, 1024, 4096 })
+    {
+        // Values take one slot, or more when they hold multiple returned values
+        std::vector<SimulatedValue> values;
+        int top = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            int pushed = slots(random);
+            values.push_back({ top, pushed });
+            top += pushed;
+        }
+
+        std::vector<std::size_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), random);
+
+        int repetitions = static_cast<int>(4000000 / count);
+        double priority = destroyValues<PriorityDeallocQueue>(values, order, repetitions);
+        double flat = destroyValues<lua::detail::DeallocQueue>(values, order, repetitions);
+
+        std::printf("%zu,%.2f,%.2f,%.2f\n", count, priority, flat, priority / flat);
+    }
+
+    return 0;
+}
@@ -0,0 +1,236 @@
+//
+//  overhead_bench.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+//
+//  Compares lua::State and lua::Value operations with equivalent hand-written Lua C API code. For each operation prints
+//  ratio of wrapper time to raw time and exits with failure when some ratio exceeds given threshold, so it can guard hot
+//  paths against regressions.
+//
+//  Usage: overhead_bench [max_ratio] [iterations]
+//
+//  Default threshold 3.0 is meant for optimized builds, where measured ratios stay around 2. Without optimizations
+//  wrapper templates aren't inlined and ratios reach 5 to 7, so CMake always builds this benchmark with -O2.
+
+#include "../include/LuaState.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+/// Results are written here, so compiler can't remove benchmarked code
+static volatile lua::Integer sink = 0;
+
+/// Number of measurements of each operation, fastest one is reported
+static const int Repetitions = 5;
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// @return Nanoseconds per operation of fastest measurement
+template<typename F>
+double measure(std::size_t iterations, std::size_t batch, F&& body)
+{
+    iterations = (iterations + batch - 1) / batch;
+
+    for (std::size_t i = 0; i < iterations / 10 + 1; ++i)
+        body();
+
+    double best = 0;
+    for (int repetition = 0; repetition < Repetitions; ++repetition)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < iterations; ++i)
+            body();
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        double time = static_cast<double>(elapsed.count()) / static_cast<double>(iterations * batch);
+        best = repetition == 0 ? time : std::min(best, time);
+    }
+    return best;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Measures both implementations of operation and prints one CSV line
+///
+/// @return False when wrapper is slower than raw code more than maxRatio times
+template<typename Raw, typename Wrapper>
+bool compare(const char* name, std::size_t iterations, double maxRatio, Raw&& raw, Wrapper&& wrapper, std::size_t batch = 1)
+{
+    double rawTime = measure(iterations, batch, raw);
+    double wrapperTime = measure(iterations, batch, wrapper);
+    double ratio = wrapperTime / rawTime;
+    bool passed = ratio <= maxRatio;
+
+    std::printf("%s,%.2f,%.2f,%.2f,%s\n", name, rawTime, wrapperTime, ratio, passed ? "ok" : "fail");
+    return passed;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static int rawAdd(lua_State* luaState)
+{
+    lua_Integer result = lua_tointeger(luaState, 1) + lua_tointeger(luaState, 2) + lua_tointeger(luaState, 3) + lua_tointeger(luaState, 4);
+    lua_pushinteger(luaState, result);
+    return 1;
+}
+
+/// Calls compiled chunk with protected call and keeps it in stack
+static void callChunk(lua_State* luaState, int index)
+{
+    lua_pushvalue(luaState, index);
+    if (lua_pcall(luaState, 0, 0, 0) != LUA_OK)
+    {
+        std::printf("error: %s\n", lua_tostring(luaState, -1));
+        std::exit(1);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static int usage(const char* program)
+{
+    std::fprintf(stderr, "usage: %s [max_ratio] [iterations]\n"
+                         "  max_ratio   positive number, maximum allowed ratio of wrapper to raw time (default 3.0)\n"
+                         "  iterations  positive integer, number of operations in one measurement (default 1000000)\n", program);
+    return 2;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    double maxRatio = 3.0;
+    std::size_t iterations = 1000000;
+
+    char* end = nullptr;
+    if (argc > 1)
+    {
+        maxRatio = std::strtod(argv[1], &end);
+        if (end == argv[1] || *end != '\0' || !(maxRatio > 0))
+            return usage(argv[0]);
+    }
+    if (argc > 2)
+    {
+        unsigned long long value = std::strtoull(argv[2], &end, 10);
+        if (end == argv[2] || *end != '\0' || argv[2][0] == '-' || value == 0)
+            return usage(argv[0]);
+        iterations = static_cast<std::size_t>(value);
+    }
+    if (argc > 3)
+        return usage(argv[0]);
+
+    lua::State state;
+    lua_State* L = state.getState();
+
+    state.doString("number = 42\n"
+                   "t = { k = 7 }\n"
+                   "text = 'The quick brown fox jumps over the lazy dog'\n"
+                   "function add(a, b, c, d) return a + b + c + d end\n"
+                   "function multi() return 1, 2, 3 end\n");
+
+    state.set("boundAdd", [](lua::Integer a, lua::Integer b, lua::Integer c, lua::Integer d) { return a + b + c + d; });
+    lua_pushcfunction(L, &rawAdd);
+    lua_setglobal(L, "rawAdd");
+
+    // Bound functions are called from Lua loops, both chunks stay in stack during benchmark
+    luaL_loadstring(L, "local f = rawAdd; for i = 1, 1000 do f(i, 2, 3, 4) end");
+    int rawLoop = lua_gettop(L);
+    luaL_loadstring(L, "local f = boundAdd; for i = 1, 1000 do f(i, 2, 3, 4) end");
+    int boundLoop = lua_gettop(L);
+
+    std::string text = "The quick brown fox jumps over the lazy dog";
+    lua::Integer counter = 0;
+    bool passed = true;
+
+    std::printf("benchmark,raw_ns_per_op,wrapper_ns_per_op,ratio,result\n");
+
+    passed &= compare("global_get", iterations, maxRatio,
+        [&]() {
+            lua_getglobal(L, "number");
+            sink = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+        },
+        [&]() {
+            sink = state["number"].toInt();
+        });
+
+    passed &= compare("global_set", iterations, maxRatio,
+        [&]() {
+            lua_pushinteger(L, ++counter);
+            lua_setglobal(L, "number");
+        },
+        [&]() {
+            state.set("number", ++counter);
+        });
+
+    passed &= compare("nested_read", iterations, maxRatio,
+        [&]() {
+            lua_getglobal(L, "t");
+            lua_getfield(L, -1, "k");
+            sink = lua_tointeger(L, -1);
+            lua_pop(L, 2);
+        },
+        [&]() {
+            sink = state["t"]["k"].to<int>();
+        });
+
+    passed &= compare("call_lua_4_args", iterations, maxRatio,
+        [&]() {
+            lua_getglobal(L, "add");
+            lua_pushinteger(L, 1);
+            lua_pushinteger(L, 2);
+            lua_pushinteger(L, 3);
+            lua_pushinteger(L, 4);
+            lua_pcall(L, 4, 1, 0);
+            sink = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+        },
+        [&]() {
+            sink = state["add"](1, 2, 3, 4).toInt();
+        });
+
+    passed &= compare("tie_3_returns", iterations, maxRatio,
+        [&]() {
+            lua_getglobal(L, "multi");
+            lua_pcall(L, 0, 3, 0);
+            sink = lua_tointeger(L, -3) + lua_tointeger(L, -2) + lua_tointeger(L, -1);
+            lua_pop(L, 3);
+        },
+        [&]() {
+            lua::Integer a, b, c;
+            lua::tie(a, b, c) = state["multi"]();
+            sink = a + b + c;
+        });
+
+    passed &= compare("string_round_trip", iterations, maxRatio,
+        [&]() {
+            lua_pushlstring(L, text.data(), text.length());
+            lua_setglobal(L, "text");
+            lua_getglobal(L, "text");
+            std::size_t length = 0;
+            const char* data = lua_tolstring(L, -1, &length);
+            sink = static_cast<lua::Integer>(std::string(data, length).size());
+            lua_pop(L, 1);
+        },
+        [&]() {
+            state.setString("text", text);
+            sink = static_cast<lua::Integer>(state["text"].toString().size());
+        });
+
+    passed &= compare("bound_function_call", iterations, maxRatio,
+        [&]() {
+            callChunk(L, rawLoop);
+        },
+        [&]() {
+            callChunk(L, boundLoop);
+        }, 1000);
+
+    lua_settop(L, 0);
+
+    if (!passed)
+    {
+        std::printf("error: overhead is bigger than %.2f\n", maxRatio);
+        return 1;
+    }
+    return 0;
+}
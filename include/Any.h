@@ -194,7 +194,7 @@ public:
         case Type::Boolean:
             return traits::ValueTraits<Boolean>::push(state, boolean);
         case Type::String:
-            return traits::ValueTraits<String>::push(state, string.c_str());
+            return traits::ValueTraits<std::string>::push(state, string);
         case Type::Tuple:
             return tuple->push(state);
 
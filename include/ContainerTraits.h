@@ -0,0 +1,200 @@
+//
+//  ContainerTraits.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "Traits.h"
+
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lua { namespace traits {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Conversion between Lua arrays and std::vector. Elements are read from indices 1 to lua_rawlen.
+    template<typename T, typename Allocator>
+    struct ValueTraits<std::vector<T, Allocator>>
+    {
+        static inline std::vector<T, Allocator> read(lua_State* luaState, int index)
+        {
+            std::vector<T, Allocator> result;
+            if (!lua_istable(luaState, index))
+                return result;
+
+            index = lua_absindex(luaState, index);
+            const std::size_t length = lua_rawlen(luaState, index);
+            result.reserve(length);
+
+            for (std::size_t i = 1; i <= length; ++i)
+            {
+                lua_rawgeti(luaState, index, i);
+                result.push_back(ValueTraits<T>::read(luaState, -1));
+                lua_pop(luaState, 1);
+            }
+            return result;
+        }
+
+        /// Checks table and all its array elements
+        static inline bool isCompatible(lua_State* luaState, int index)
+        {
+            if (!lua_istable(luaState, index))
+                return false;
+
+            index = lua_absindex(luaState, index);
+            const std::size_t length = lua_rawlen(luaState, index);
+
+            for (std::size_t i = 1; i <= length; ++i)
+            {
+                lua_rawgeti(luaState, index, i);
+                bool compatible = ValueTraits<T>::isCompatible(luaState, -1);
+                lua_pop(luaState, 1);
+                if (!compatible)
+                    return false;
+            }
+            return true;
+        }
+
+        static inline int push(lua_State* luaState, const std::vector<T, Allocator>& value)
+        {
+            lua_createtable(luaState, static_cast<int>(value.size()), 0);
+
+            lua::Integer i = 1;
+            for (const auto& element : value)
+            {
+                ValueTraits<T>::push(luaState, element);
+                lua_rawseti(luaState, -2, i++);
+            }
+            return 1;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Conversion between Lua arrays and std::array. Missing elements are read from nil values.
+    template<typename T, std::size_t N>
+    struct ValueTraits<std::array<T, N>>
+    {
+        static inline std::array<T, N> read(lua_State* luaState, int index)
+        {
+            std::array<T, N> result{};
+            if (!lua_istable(luaState, index))
+                return result;
+
+            index = lua_absindex(luaState, index);
+            for (std::size_t i = 0; i < N; ++i)
+            {
+                lua_rawgeti(luaState, index, i + 1);
+                result[i] = ValueTraits<T>::read(luaState, -1);
+                lua_pop(luaState, 1);
+            }
+            return result;
+        }
+
+        /// Checks that table has exactly N array elements with compatible type
+        static inline bool isCompatible(lua_State* luaState, int index)
+        {
+            if (!lua_istable(luaState, index) || lua_rawlen(luaState, index) != N)
+                return false;
+
+            index = lua_absindex(luaState, index);
+            for (std::size_t i = 1; i <= N; ++i)
+            {
+                lua_rawgeti(luaState, index, i);
+                bool compatible = ValueTraits<T>::isCompatible(luaState, -1);
+                lua_pop(luaState, 1);
+                if (!compatible)
+                    return false;
+            }
+            return true;
+        }
+
+        static inline int push(lua_State* luaState, const std::array<T, N>& value)
+        {
+            lua_createtable(luaState, static_cast<int>(N), 0);
+
+            for (std::size_t i = 0; i < N; ++i)
+            {
+                ValueTraits<T>::push(luaState, value[i]);
+                lua_rawseti(luaState, -2, i + 1);
+            }
+            return 1;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Conversion between Lua tables and associative containers. Pairs whose key or value has wrong type are read
+    /// same way as by ValueTraits of their types.
+    template<typename Map>
+    struct MapTraits
+    {
+        using Key = typename Map::key_type;
+        using Mapped = typename Map::mapped_type;
+
+        static inline Map read(lua_State* luaState, int index)
+        {
+            Map result;
+            if (!lua_istable(luaState, index))
+                return result;
+
+            index = lua_absindex(luaState, index);
+            lua_pushnil(luaState);
+            while (lua_next(luaState, index) != 0)
+            {
+                // Key is read from its copy, because lua_tolstring would change it and confuse lua_next
+                lua_pushvalue(luaState, -2);
+                Key key = ValueTraits<Key>::read(luaState, -1);
+                result.emplace(std::move(key), ValueTraits<Mapped>::read(luaState, -2));
+                lua_pop(luaState, 2);
+            }
+            return result;
+        }
+
+        /// Checks table and all its keys and values
+        static inline bool isCompatible(lua_State* luaState, int index)
+        {
+            if (!lua_istable(luaState, index))
+                return false;
+
+            index = lua_absindex(luaState, index);
+            lua_pushnil(luaState);
+            while (lua_next(luaState, index) != 0)
+            {
+                if (!ValueTraits<Key>::isCompatible(luaState, -2) || !ValueTraits<Mapped>::isCompatible(luaState, -1))
+                {
+                    lua_pop(luaState, 2);
+                    return false;
+                }
+                lua_pop(luaState, 1);
+            }
+            return true;
+        }
+
+        static inline int push(lua_State* luaState, const Map& value)
+        {
+            lua_createtable(luaState, 0, static_cast<int>(value.size()));
+
+            for (const auto& pair : value)
+            {
+                ValueTraits<Key>::push(luaState, pair.first);
+                ValueTraits<Mapped>::push(luaState, pair.second);
+                lua_rawset(luaState, -3);
+            }
+            return 1;
+        }
+    };
+
+    template<typename K, typename V, typename Compare, typename Allocator>
+    struct ValueTraits<std::map<K, V, Compare, Allocator>> : MapTraits<std::map<K, V, Compare, Allocator>>
+    {
+    };
+
+    template<typename K, typename V, typename Hash, typename KeyEqual, typename Allocator>
+    struct ValueTraits<std::unordered_map<K, V, Hash, KeyEqual, Allocator>> : MapTraits<std::unordered_map<K, V, Hash, KeyEqual, Allocator>>
+    {
+    };
+}}
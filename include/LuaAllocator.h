@@ -0,0 +1,318 @@
+//
+//  LuaAllocator.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include <lua.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace lua {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Base class for memory allocation policies of lua::State. All memory of Lua state (tables, strings, closures...)
+    /// is requested through reallocate function.
+    class BaseAllocator
+    {
+    public:
+
+        virtual ~BaseAllocator() = default;
+
+        /// Allocates, resizes or frees memory block. Semantics are same as with lua_Alloc function.
+        ///
+        /// @param ptr      Block which will be resized or freed, nullptr when new block is requested
+        /// @param oldSize  Size of block pointed by ptr, zero when ptr is nullptr
+        /// @param newSize  Requested size of block, zero when block should be freed
+        ///
+        /// @return New block, or nullptr when block was freed or when allocation failed
+        virtual void* reallocate(void* ptr, std::size_t oldSize, std::size_t newSize) noexcept = 0;
+
+        /// Function with lua_Alloc signature which is passed to lua_newstate. User data must point to BaseAllocator instance.
+        static void* luaAllocate(void* userData, void* ptr, std::size_t oldSize, std::size_t newSize) noexcept
+        {
+            // When ptr is NULL, Lua passes type of allocated object in oldSize, so we will not forward it
+            return static_cast<BaseAllocator*>(userData)->reallocate(ptr, ptr == nullptr ? 0 : oldSize, newSize);
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Allocator with free lists for small blocks. Small blocks are grouped to size classes by Granularity bytes and are
+    /// carved from larger chunks, which are released only when allocator is destroyed. Blocks bigger than MaxPooledSize
+    /// are allocated with std::realloc.
+    ///
+    /// @note Allocator is not thread safe, it is meant to be used by single lua::State
+    class PoolAllocator : public BaseAllocator
+    {
+    public:
+
+        enum : std::size_t
+        {
+            /// Difference between sizes of two neighbouring size classes
+            Granularity = 16,
+
+            /// Biggest block which is served from free lists
+            MaxPooledSize = 256,
+
+            /// Number of size classes with free lists
+            SizeClasses = MaxPooledSize / Granularity,
+
+            /// Size of chunk from which are small blocks carved
+            ChunkSize = 16 * 1024,
+        };
+
+        /// Allocation counters
+        struct Statistics
+        {
+            /// Bytes currently requested by Lua state
+            std::size_t liveBytes = 0;
+
+            /// Maximum of liveBytes since creation of allocator
+            std::size_t peakBytes = 0;
+
+            /// Number of allocations served by each size class. Last element counts allocations bigger than MaxPooledSize
+            std::array<std::size_t, SizeClasses + 1> allocations;
+
+            Statistics()
+            {
+                allocations.fill(0);
+            }
+        };
+
+        PoolAllocator() = default;
+
+        ~PoolAllocator()
+        {
+            while (m_chunks != nullptr)
+            {
+                Chunk* next = m_chunks->next;
+                std::free(m_chunks);
+                m_chunks = next;
+            }
+        }
+
+        // Allocator is non-copyable
+        PoolAllocator(const PoolAllocator&) = delete;
+        PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+        void* reallocate(void* ptr, std::size_t oldSize, std::size_t newSize) noexcept override
+        {
+            if (newSize == 0)
+            {
+                if (ptr != nullptr)
+                {
+                    release(ptr, oldSize);
+                    m_statistics.liveBytes -= oldSize;
+                }
+                return nullptr;
+            }
+
+            void* block = nullptr;
+
+            if (ptr == nullptr)
+            {
+                block = acquire(newSize);
+            }
+            else if (oldSize <= MaxPooledSize && newSize <= MaxPooledSize && sizeClass(oldSize) == sizeClass(newSize))
+            {
+                // Block has still enough space, we can keep it
+                block = ptr;
+            }
+            else if (oldSize > MaxPooledSize && newSize > MaxPooledSize)
+            {
+                block = std::realloc(ptr, newSize);
+                if (block != nullptr)
+                    ++m_statistics.allocations[SizeClasses];
+            }
+            else
+            {
+                // Block moves between free list and fallback allocation
+                block = acquire(newSize);
+                if (block != nullptr)
+                {
+                    std::memcpy(block, ptr, std::min(oldSize, newSize));
+                    release(ptr, oldSize);
+                }
+            }
+
+            if (block != nullptr)
+            {
+                m_statistics.liveBytes += newSize;
+                m_statistics.liveBytes -= oldSize;
+                m_statistics.peakBytes = std::max(m_statistics.peakBytes, m_statistics.liveBytes);
+            }
+            return block;
+        }
+
+        /// @return Allocation counters of this allocator
+        const Statistics& getStatistics() const
+        {
+            return m_statistics;
+        }
+
+    private:
+
+        /// Header of chunk, blocks are following right after it
+        union Chunk
+        {
+            Chunk* next;
+            char padding[Granularity];
+        };
+
+        /// Free block, which holds pointer to next free block of same size class
+        struct FreeBlock
+        {
+            FreeBlock* next;
+        };
+
+        static std::size_t sizeClass(std::size_t size) noexcept
+        {
+            return (size - 1) / Granularity;
+        }
+
+        void* acquire(std::size_t size) noexcept
+        {
+            if (size > MaxPooledSize)
+            {
+                void* block = std::malloc(size);
+                if (block != nullptr)
+                    ++m_statistics.allocations[SizeClasses];
+                return block;
+            }
+
+            std::size_t index = sizeClass(size);
+            if (m_freeLists[index] == nullptr && !refill(index))
+                return nullptr;
+
+            FreeBlock* block = m_freeLists[index];
+            m_freeLists[index] = block->next;
+            ++m_statistics.allocations[index];
+            return block;
+        }
+
+        void release(void* ptr, std::size_t size) noexcept
+        {
+            if (size > MaxPooledSize)
+            {
+                std::free(ptr);
+                return;
+            }
+
+            std::size_t index = sizeClass(size);
+            FreeBlock* block = static_cast<FreeBlock*>(ptr);
+            block->next = m_freeLists[index];
+            m_freeLists[index] = block;
+        }
+
+        /// Carves new chunk to blocks of given size class and puts them to free list
+        bool refill(std::size_t index) noexcept
+        {
+            Chunk* chunk = static_cast<Chunk*>(std::malloc(ChunkSize));
+            if (chunk == nullptr)
+                return false;
+
+            chunk->next = m_chunks;
+            m_chunks = chunk;
+
+            const std::size_t blockSize = (index + 1) * Granularity;
+            char* begin = reinterpret_cast<char*>(chunk + 1);
+            char* end = reinterpret_cast<char*>(chunk) + ChunkSize;
+
+            for (char* block = begin; block + blockSize <= end; block += blockSize)
+            {
+                FreeBlock* freeBlock = reinterpret_cast<FreeBlock*>(block);
+                freeBlock->next = m_freeLists[index];
+                m_freeLists[index] = freeBlock;
+            }
+            return true;
+        }
+
+        /// Heads of free lists for each size class
+        std::array<FreeBlock*, SizeClasses> m_freeLists{ {} };
+
+        /// List of all allocated chunks
+        Chunk* m_chunks = nullptr;
+
+        Statistics m_statistics;
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Allocator layer which counts memory of Lua state and refuses allocations over given limit. Memory is requested
+    /// from wrapped allocator, or with std::realloc when there is none.
+    class AccountingAllocator final : public BaseAllocator
+    {
+    public:
+
+        /// @param allocator    Wrapped allocator, it is owned by this instance
+        explicit AccountingAllocator(std::unique_ptr<BaseAllocator> allocator = nullptr)
+            : m_allocator(std::move(allocator))
+        {
+        }
+
+        void* reallocate(void* ptr, std::size_t oldSize, std::size_t newSize) noexcept override
+        {
+            // Lua expects that shrinking of blocks never fails, so we check only growing
+            if (m_limit != 0 && newSize > oldSize && newSize - oldSize > m_limit - std::min(m_limit, m_usedBytes))
+                return nullptr;
+
+            void* block = nullptr;
+            if (m_allocator)
+            {
+                block = m_allocator->reallocate(ptr, oldSize, newSize);
+            }
+            else if (newSize == 0)
+            {
+                std::free(ptr);
+            }
+            else
+            {
+                block = std::realloc(ptr, newSize);
+            }
+
+            if (block != nullptr || newSize == 0)
+            {
+                m_usedBytes += newSize;
+                m_usedBytes -= oldSize;
+            }
+            return block;
+        }
+
+        /// @return Wrapped allocator or nullptr when memory is allocated with std::realloc
+        BaseAllocator* getAllocator() const
+        {
+            return m_allocator.get();
+        }
+
+        /// @return Number of bytes currently allocated through this allocator
+        std::size_t getUsedBytes() const
+        {
+            return m_usedBytes;
+        }
+
+        /// @return Maximum number of bytes which can be allocated, zero when there is no limit
+        std::size_t getLimit() const
+        {
+            return m_limit;
+        }
+
+        /// @param limit    Maximum number of bytes which can be allocated, zero when there is no limit
+        void setLimit(std::size_t limit)
+        {
+            m_limit = limit;
+        }
+
+    private:
+
+        std::unique_ptr<BaseAllocator> m_allocator;
+
+        std::size_t m_usedBytes = 0;
+
+        std::size_t m_limit = 0;
+    };
+}
@@ -0,0 +1,508 @@
+//
+//  LuaAsync.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaCoroutine.h"
+
+#if defined(LUASTATE_CXX20) && LUA_VERSION_NUM >= 503
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace lua {
+
+    template<typename T = void>
+    class Task;
+
+    class EventLoop;
+
+    namespace detail {
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Resumes coroutine which awaits finished task, otherwise returns to caller of resume
+        struct TaskFinalAwaiter
+        {
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+        };
+
+        struct TaskPromiseBase
+        {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+
+            /// Tasks are started immediately, so operation which completes synchronously doesn't suspend anything
+            std::suspend_never initial_suspend() const noexcept
+            {
+                return {};
+            }
+
+            TaskFinalAwaiter final_suspend() const noexcept
+            {
+                return {};
+            }
+
+            void unhandled_exception() noexcept
+            {
+                exception = std::current_exception();
+            }
+        };
+
+        template<typename T>
+        struct TaskPromise : TaskPromiseBase
+        {
+            std::optional<T> value;
+
+            void return_value(T result)
+            {
+                value.emplace(std::move(result));
+            }
+        };
+
+        template<>
+        struct TaskPromise<void> : TaskPromiseBase
+        {
+            void return_void() const noexcept
+            {
+            }
+        };
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Coroutine which isn't awaited by anyone, its frame is destroyed when it finishes
+        struct DetachedTask
+        {
+            struct promise_type
+            {
+                DetachedTask get_return_object() const noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() const noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never final_suspend() const noexcept
+                {
+                    return {};
+                }
+
+                void return_void() const noexcept
+                {
+                }
+
+                void unhandled_exception() const noexcept
+                {
+                    std::terminate();
+                }
+            };
+        };
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Result of asynchronous C++ operation. Task is C++20 coroutine, which is started immediately and it can await
+    /// other tasks and timers of lua::EventLoop.
+    ///
+    /// When bound function returns task, which isn't finished yet, Lua script which called it is suspended and it is
+    /// resumed by lua::EventLoop with result of task. Script sees it as ordinary function call. Exceptions thrown by task
+    /// are raised as Lua errors.
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// state.set("fetch", [&loop](int id) -> lua::Task<std::string> {
+    ///     co_await loop.sleep(std::chrono::milliseconds(10));
+    ///     co_return "item " + std::to_string(id);
+    /// });
+    /// ~~~~~~~~~~~~~~~
+    template<typename T>
+    class Task final
+    {
+    public:
+
+        struct promise_type : detail::TaskPromise<T>
+        {
+            Task get_return_object() noexcept
+            {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+        };
+
+    private:
+
+        std::coroutine_handle<promise_type> m_handle;
+
+        explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+            : m_handle(handle)
+        {
+        }
+
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() const noexcept
+            {
+                return handle.done();
+            }
+
+            void await_suspend(std::coroutine_handle<> awaiting) const noexcept
+            {
+                handle.promise().continuation = awaiting;
+            }
+
+            T await_resume() const
+            {
+                return Task::result(handle);
+            }
+        };
+
+        static T result(std::coroutine_handle<promise_type> handle)
+        {
+            if (handle.promise().exception)
+                std::rethrow_exception(handle.promise().exception);
+
+            if constexpr (!std::is_void_v<T>)
+                return std::move(*handle.promise().value);
+        }
+
+    public:
+
+        ~Task()
+        {
+            if (m_handle)
+                m_handle.destroy();
+        }
+
+        // Task is non-copyable, but it can be moved
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        Task(Task&& other) noexcept
+            : m_handle(std::exchange(other.m_handle, nullptr))
+        {
+        }
+
+        Task& operator=(Task&& other) noexcept
+        {
+            if (this != &other)
+            {
+                if (m_handle)
+                    m_handle.destroy();
+                m_handle = std::exchange(other.m_handle, nullptr);
+            }
+            return *this;
+        }
+
+        /// @return True when task finished with result or exception
+        bool isReady() const noexcept
+        {
+            return m_handle.done();
+        }
+
+        /// @throws Exception thrown by task
+        ///
+        /// @return Result of finished task
+        T get() const
+        {
+            assert(isReady());
+            return result(m_handle);
+        }
+
+        Awaiter operator co_await() const noexcept
+        {
+            return Awaiter{ m_handle };
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Single threaded event loop, which runs Lua scripts as coroutines and resumes them when tasks awaited by their
+    /// bound functions finish. Many scripts can wait at once, so their waits overlap on one thread.
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// lua::EventLoop loop(state);
+    /// state.set("sleep", [&loop](int ms) -> lua::Task<> { co_await loop.sleep(std::chrono::milliseconds(ms)); });
+    ///
+    /// loop.spawn(state["handleRequest"], 1);
+    /// loop.spawn(state["handleRequest"], 2);
+    /// loop.run();
+    /// ~~~~~~~~~~~~~~~
+    ///
+    /// @note Only one event loop can be attached to lua::State. Loop must be run until it is empty before it is destroyed.
+    class EventLoop final
+    {
+        using Clock = std::chrono::steady_clock;
+
+        struct Timer
+        {
+            Clock::time_point deadline;
+
+            /// Timers with same deadline are resumed in order in which they were created
+            std::uint64_t sequence;
+
+            std::coroutine_handle<> handle;
+
+            bool operator>(const Timer& other) const
+            {
+                return deadline != other.deadline ? deadline > other.deadline : sequence > other.sequence;
+            }
+        };
+
+        struct SleepAwaiter
+        {
+            EventLoop* loop;
+            Clock::time_point deadline;
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                loop->m_timers.push({ deadline, loop->m_timerSequence++, handle });
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+        };
+
+        struct Script
+        {
+            Coroutine coroutine;
+
+            /// True when script waits for result of task, otherwise it yielded and it is resumed by loop
+            bool awaiting = false;
+        };
+
+        /// Address of this variable is key of event loop in LUA_REGISTRYINDEX
+        static inline const char s_registryKey = 0;
+
+        lua_State* m_luaState;
+
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> m_timers;
+        std::uint64_t m_timerSequence = 0;
+
+        std::deque<std::function<void()>> m_callbacks;
+
+        /// Running scripts indexed by their Lua threads
+        std::unordered_map<lua_State*, std::unique_ptr<Script>> m_scripts;
+
+        template<typename... Ts>
+        void resumeScript(lua_State* thread, Ts&&... args)
+        {
+            auto iterator = m_scripts.find(thread);
+            if (iterator == m_scripts.end())
+                return;
+
+            // Script can spawn other scripts, so only reference to script stays valid after resume
+            Script& script = *iterator->second;
+            script.awaiting = false;
+            try {
+                script.coroutine.resume(std::forward<Ts>(args)...);
+            } catch (...) {
+                m_scripts.erase(thread);
+                throw;
+            }
+
+            if (script.coroutine.getStatus() != Coroutine::Status::Suspended)
+                m_scripts.erase(thread);
+            else if (!script.awaiting)
+                post([this, thread]() { resumeScript(thread); });
+        }
+
+        /// Resumes script when task is finished, frame of this coroutine keeps task alive until then
+        template<typename T>
+        detail::DetachedTask resumeAfter(Task<T> task, lua_State* thread)
+        {
+            std::string message;
+            try {
+                if constexpr (std::is_void_v<T>)
+                {
+                    co_await task;
+                    post([this, thread]() { resumeScript(thread, true); });
+                }
+                else
+                {
+                    T result = co_await task;
+                    post([this, thread, result = std::move(result)]() mutable { resumeScript(thread, true, std::move(result)); });
+                }
+                co_return;
+            } catch (const std::exception& ex) {
+                message = ex.what();
+            } catch (...) {
+                message = "unknown exception in awaited task";
+            }
+            post([this, thread, message = std::move(message)]() { resumeScript(thread, false, message); });
+        }
+
+    public:
+
+        /// Attaches event loop to state
+        explicit EventLoop(State& state)
+            : m_luaState(state.getState())
+        {
+            assert(fromState(m_luaState) == nullptr);
+            lua_pushlightuserdata(m_luaState, this);
+            lua_rawsetp(m_luaState, LUA_REGISTRYINDEX, &s_registryKey);
+        }
+
+        ~EventLoop()
+        {
+            m_scripts.clear();
+            lua_pushnil(m_luaState);
+            lua_rawsetp(m_luaState, LUA_REGISTRYINDEX, &s_registryKey);
+        }
+
+        // Event loop is non-copyable
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        /// @return Event loop attached to Lua state of given thread, or nullptr when there is none
+        static EventLoop* fromState(lua_State* luaState)
+        {
+            lua_rawgetp(luaState, LUA_REGISTRYINDEX, &s_registryKey);
+            EventLoop* loop = static_cast<EventLoop*>(lua_touserdata(luaState, -1));
+            lua_pop(luaState, 1);
+            return loop;
+        }
+
+        /// Starts Lua function as script of event loop. Function runs until it awaits first task or yields.
+        ///
+        /// @throws lua::RuntimeError       When script raises error before it is suspended
+        /// @throws lua::MemoryLimitError   When memory limit was reached
+        template<typename... Ts>
+        void spawn(const Value& function, Ts&&... args)
+        {
+            std::unique_ptr<Script> script(new Script{ Coroutine(function) });
+            lua_State* thread = script->coroutine.getThread();
+            m_scripts.emplace(thread, std::move(script));
+            resumeScript(thread, std::forward<Ts>(args)...);
+        }
+
+        /// Suspends script which called bound function until task is finished
+        ///
+        /// @return False when given thread isn't script of this loop or it can't yield
+        template<typename T>
+        bool await(lua_State* thread, Task<T>&& task)
+        {
+            auto iterator = m_scripts.find(thread);
+            if (iterator == m_scripts.end() || !lua_isyieldable(thread))
+                return false;
+
+            iterator->second->awaiting = true;
+            resumeAfter(std::move(task), thread);
+            return true;
+        }
+
+        /// @return Awaitable, which resumes awaiting coroutine after given time
+        SleepAwaiter sleep(Clock::duration duration)
+        {
+            return SleepAwaiter{ this, Clock::now() + duration };
+        }
+
+        /// Calls function from next iteration of loop
+        void post(std::function<void()> callback)
+        {
+            m_callbacks.push_back(std::move(callback));
+        }
+
+        /// Runs posted functions and timers until there is nothing to wait for
+        ///
+        /// @throws lua::RuntimeError       When script raises error, its script is removed and loop can be run again
+        /// @throws lua::MemoryLimitError   When memory limit was reached
+        void run()
+        {
+            while (!m_callbacks.empty() || !m_timers.empty())
+            {
+                if (!m_callbacks.empty())
+                {
+                    std::function<void()> callback = std::move(m_callbacks.front());
+                    m_callbacks.pop_front();
+                    callback();
+                    continue;
+                }
+
+                Timer timer = m_timers.top();
+                if (timer.deadline > Clock::now())
+                    std::this_thread::sleep_until(timer.deadline);
+
+                m_timers.pop();
+                timer.handle.resume();
+            }
+        }
+
+        /// @return Number of scripts, which didn't finish yet
+        std::size_t getScriptCount() const
+        {
+            return m_scripts.size();
+        }
+    };
+
+    namespace traits {
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Result of bound function, which suspends calling script until task is finished
+        template<typename T>
+        struct ValueTraits<Task<T>>
+        {
+            static inline int push(lua_State* luaState, Task<T>&& task)
+            {
+                if (task.isReady())
+                {
+                    try {
+                        if constexpr (std::is_void_v<T>)
+                        {
+                            task.get();
+                            return 0;
+                        }
+                        else
+                        {
+                            return ValueTraits<RemoveCVR<T>>::push(luaState, task.get());
+                        }
+                    } catch (const std::exception& ex) {
+                        lua_pushstring(luaState, ex.what());
+                        return detail::CallRaiseError;
+                    }
+                }
+
+                EventLoop* loop = EventLoop::fromState(luaState);
+                if (loop == nullptr || !loop->await(luaState, std::move(task)))
+                {
+                    lua_pushliteral(luaState, "asynchronous function must be called from script spawned to lua::EventLoop");
+                    return detail::CallRaiseError;
+                }
+                return detail::CallSuspend;
+            }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,441 @@
+//
+//  LuaBudget.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaException.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <new>
+
+namespace lua {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Limits of script execution. When script exceeds them, protected call throws lua::ExecutionLimitError. Error is
+    /// raised again after each instruction, so script can't catch it with pcall and continue.
+    struct ExecutionBudget
+    {
+        /// Maximum number of executed Lua instructions, zero means no limit
+        std::uint64_t instructions = 0;
+
+        /// Maximum duration of execution measured by monotonic clock, zero means no deadline
+        std::chrono::nanoseconds timeout{ 0 };
+
+        ExecutionBudget() = default;
+
+        ExecutionBudget(std::uint64_t maxInstructions, std::chrono::nanoseconds maxDuration = std::chrono::nanoseconds(0))
+            : instructions(maxInstructions)
+            , timeout(maxDuration)
+        {
+        }
+
+        /// @return True when budget has some limit
+        bool isLimited() const
+        {
+            return instructions != 0 || timeout.count() != 0;
+        }
+    };
+
+    namespace detail {
+
+        /// Address of this variable is key of HookState in LUA_REGISTRYINDEX
+        template<typename T = void>
+        struct HookKey
+        {
+            static const char state;
+        };
+
+        template<typename T>
+        const char HookKey<T>::state = 0;
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Receiver of samples taken by count hook, see lua::Profiler
+        class Sampler
+        {
+        public:
+
+            virtual ~Sampler() = default;
+
+            /// Called from count hook while Lua code is running
+            virtual void sample(lua_State* luaState) = 0;
+
+            /// Called when bound C++ function returns, it is on level 0 of Lua stack and its results are on top of stack
+            ///
+            /// @param function     Userdata in first upvalue of function, nullptr when it has none
+            virtual void nativeCall(lua_State* luaState, const void* function, std::chrono::steady_clock::time_point start) = 0;
+
+            /// Called when outermost call starts, time between calls isn't attributed to any function
+            virtual void callStarted() = 0;
+        };
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Counters of active budget and profiler. They are stored in userdata in LUA_REGISTRYINDEX, so count hook can
+        /// find them. Budget and profiler share one count hook, which is called after number of instructions needed by
+        /// nearest of them.
+        struct HookState
+        {
+            /// Maximum number of instructions between two calls of hook while budget counters are armed, deadline is checked
+            /// with same period
+            static const int HookInterval = 1000;
+
+            struct Counters
+            {
+                bool limitInstructions = false;
+                std::int64_t remainingInstructions = 0;
+
+                bool limitTime = false;
+                std::chrono::steady_clock::time_point deadline;
+            };
+
+            /// Budget of each call made through lua::State, lua::Value or lua::Chunk
+            ExecutionBudget stateBudget;
+
+            /// Counters of budget of current call or of lua::BudgetGuard
+            Counters counters;
+
+            /// True while lua::BudgetGuard is active, calls don't reset counters then
+            bool guarded = false;
+
+            /// Number of nested calls, counters are reset only when outermost call starts
+            int depth = 0;
+
+            /// Profiler which receives samples, nullptr when it isn't running
+            Sampler* sampler = nullptr;
+            int sampleInterval = 0;
+            std::int64_t untilSample = 0;
+
+            /// @return True when count hook is needed
+            bool isActive() const
+            {
+                return guarded || stateBudget.isLimited() || sampler != nullptr;
+            }
+        };
+
+        /// @return Hook counters of Lua state, or nullptr when no budget or profiler was used
+        inline HookState* findHookState(lua_State* luaState)
+        {
+            lua_rawgetp(luaState, LUA_REGISTRYINDEX, &HookKey<>::state);
+            HookState* state = static_cast<HookState*>(lua_touserdata(luaState, -1));
+            lua_pop(luaState, 1);
+            return state;
+        }
+
+        void countHook(lua_State* luaState, lua_Debug*);
+
+        /// Gives resumed thread count hook of resuming thread. Threads inherit hook when they are created, but coroutine
+        /// could be created before budget or profiler installed hook, or while hook had longer interval outside of
+        /// protected calls. Hook with same interval is kept, so its partial count isn't lost.
+        inline void inheritHook(lua_State* luaState, lua_State* thread)
+        {
+            if (lua_gethook(luaState) == &countHook)
+            {
+                int interval = lua_gethookcount(luaState);
+                if (lua_gethook(thread) != &countHook || lua_gethookcount(thread) != interval)
+                    lua_sethook(thread, &countHook, LUA_MASKCOUNT, interval);
+            }
+            else if (lua_gethook(thread) == &countHook)
+            {
+                lua_sethook(thread, nullptr, 0, 0);
+            }
+        }
+
+        /// Replacement of coroutine.resume, which passes hook to resumed coroutine. Original function is upvalue.
+        /// Exceeded budget is raised again in resuming thread, so scripts can't catch it with coroutine.resume either.
+        inline int resumeCoroutine(lua_State* luaState)
+        {
+            lua_State* thread = lua_tothread(luaState, 1);
+            luaL_argcheck(luaState, thread != nullptr, 1, "coroutine expected");
+            inheritHook(luaState, thread);
+
+            lua_pushvalue(luaState, lua_upvalueindex(1));
+            lua_insert(luaState, 1);
+            lua_call(luaState, lua_gettop(luaState) - 1, LUA_MULTRET);
+
+            if (!lua_toboolean(luaState, 1) && lua_type(luaState, 2) == LUA_TLIGHTUSERDATA)
+            {
+                const void* error = lua_touserdata(luaState, 2);
+                if (error == &ExecutionLimitKey<>::instructions || error == &ExecutionLimitKey<>::deadline)
+                {
+                    lua_pushvalue(luaState, 2);
+                    return lua_error(luaState);
+                }
+            }
+            return lua_gettop(luaState);
+        }
+
+        /// @return Hook counters of Lua state, they are created when they don't exist yet. Function coroutine.resume is
+        /// replaced then, so budgets and profiler cover also coroutines created before them. Coroutines created by
+        /// coroutine.wrap before that and resume functions saved by scripts before that aren't covered.
+        inline HookState& getHookState(lua_State* luaState)
+        {
+            HookState* state = findHookState(luaState);
+            if (state == nullptr)
+            {
+                // State is trivially destructible, so userdata doesn't need metatable
+                state = new (lua_newuserdata(luaState, sizeof(HookState))) HookState();
+                lua_rawsetp(luaState, LUA_REGISTRYINDEX, &HookKey<>::state);
+
+                lua_getglobal(luaState, "coroutine");
+                if (lua_istable(luaState, -1))
+                {
+                    lua_getfield(luaState, -1, "resume");
+                    if (lua_tocfunction(luaState, -1) != nullptr)
+                    {
+                        lua_pushcclosure(luaState, &resumeCoroutine, 1);
+                        lua_setfield(luaState, -2, "resume");
+                    }
+                    else
+                    {
+                        lua_pop(luaState, 1);
+                    }
+                }
+                lua_pop(luaState, 1);
+            }
+            return *state;
+        }
+
+        /// Installs count hook with interval needed by budget and profiler, or removes it when it isn't needed. Hook with
+        /// same interval isn't installed again, because that would restart its count.
+        inline void scheduleHook(lua_State* luaState, HookState& state)
+        {
+            if (!state.isActive())
+            {
+                lua_sethook(luaState, nullptr, 0, 0);
+                return;
+            }
+
+            // Deadline is checked periodically, profiler alone needs hook only when sample is due
+            std::int64_t interval = std::numeric_limits<int>::max();
+            if (state.counters.limitInstructions || state.counters.limitTime)
+                interval = HookState::HookInterval;
+
+            // Instructions are counted exactly only inside protected calls, where exceeded budget can be raised
+            if (state.counters.limitInstructions && state.depth > 0)
+                interval = std::min(interval, std::max<std::int64_t>(state.counters.remainingInstructions, 1));
+            if (state.sampler != nullptr)
+                interval = std::min(interval, std::max<std::int64_t>(state.untilSample, 1));
+
+            if (lua_gethook(luaState) != &countHook || lua_gethookcount(luaState) != interval)
+                lua_sethook(luaState, &countHook, LUA_MASKCOUNT, static_cast<int>(interval));
+        }
+
+        /// Count hook which takes samples for profiler and raises error when budget is exceeded
+        inline void countHook(lua_State* luaState, lua_Debug*)
+        {
+            HookState* state = findHookState(luaState);
+            if (state == nullptr)
+                return;
+
+            // Each thread has its own count, coroutine could inherit different one than thread which resumed it
+            int interval = lua_gethookcount(luaState);
+            if (state->sampler != nullptr)
+            {
+                state->untilSample -= interval;
+                if (state->untilSample <= 0)
+                {
+                    state->untilSample = state->sampleInterval;
+                    state->sampler->sample(luaState);
+                }
+            }
+
+            const char* exceeded = nullptr;
+            HookState::Counters& counters = state->counters;
+            if (counters.limitInstructions)
+            {
+                counters.remainingInstructions -= interval;
+                if (counters.remainingInstructions <= 0)
+                    exceeded = &ExecutionLimitKey<>::instructions;
+            }
+            if (exceeded == nullptr && counters.limitTime && std::chrono::steady_clock::now() >= counters.deadline)
+                exceeded = &ExecutionLimitKey<>::deadline;
+
+            // Error can be raised only inside protected call, unprotected code outside of them isn't limited
+            if (exceeded != nullptr && state->depth > 0)
+            {
+                // Hook is called after each instruction from now on, so error is raised again when script catches it
+                lua_sethook(luaState, &countHook, LUA_MASKCOUNT, 1);
+                lua_pushlightuserdata(luaState, const_cast<char*>(exceeded));
+                lua_error(luaState);
+            }
+
+            scheduleHook(luaState, *state);
+        }
+
+        /// Resets counters to given budget and installs hook
+        inline void startBudget(lua_State* luaState, HookState& state, const ExecutionBudget& budget)
+        {
+            HookState::Counters& counters = state.counters;
+            counters.limitInstructions = budget.instructions != 0;
+            counters.remainingInstructions = static_cast<std::int64_t>(std::min<std::uint64_t>(budget.instructions, std::numeric_limits<std::int64_t>::max()));
+
+            counters.limitTime = budget.timeout.count() != 0;
+            if (counters.limitTime)
+                counters.deadline = std::chrono::steady_clock::now() + budget.timeout;
+
+            scheduleHook(luaState, state);
+        }
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Starts budget of lua::State when outermost protected call starts and stops it when that call returns. Budget
+        /// error is raised only while some call is active, so it is always caught by its lua_pcall or lua_resume. States
+        /// without budget or profiler don't have hook installed, so they pay only for one check of hook.
+        class BudgetCall
+        {
+            lua_State* m_luaState;
+            HookState* m_state = nullptr;
+
+            void enter()
+            {
+                m_state = findHookState(m_luaState);
+                if (m_state->depth++ > 0)
+                    return;
+
+                if (m_state->sampler != nullptr)
+                    m_state->sampler->callStarted();
+                if (!m_state->guarded && m_state->stateBudget.isLimited())
+                    startBudget(m_luaState, *m_state, m_state->stateBudget);
+                else
+                    scheduleHook(m_luaState, *m_state);
+            }
+
+        public:
+
+            explicit BudgetCall(lua_State* luaState)
+                : m_luaState(luaState)
+            {
+                if (lua_gethook(luaState) == &countHook)
+                    enter();
+            }
+
+            /// Starts budget of coroutine resumed from C++. Coroutine thread inherited hook of thread which created it,
+            /// so its hook is synchronized with main thread first, where budgets and profiler install it.
+            BudgetCall(lua_State* thread, lua_State* mainThread)
+                : m_luaState(thread)
+            {
+                if (lua_gethook(mainThread) == &countHook)
+                    enter();
+                else if (lua_gethook(thread) == &countHook)
+                    lua_sethook(thread, nullptr, 0, 0);
+            }
+
+            ~BudgetCall()
+            {
+                if (m_state == nullptr || --m_state->depth > 0 || m_state->guarded)
+                    return;
+
+                // Code executed outside of protected calls isn't limited
+                m_state->counters = HookState::Counters();
+                if (lua_gethook(m_luaState) == &countHook)
+                    scheduleHook(m_luaState, *m_state);
+            }
+
+            BudgetCall(const BudgetCall&) = delete;
+            BudgetCall& operator=(const BudgetCall&) = delete;
+        };
+
+        /// Lets profiler know that unprotected call starts. Only outermost call restarts its clock, call from bound
+        /// function has that function on level 0 of Lua stack.
+        inline void startUnprotectedCall(lua_State* luaState)
+        {
+            if (lua_gethook(luaState) != &countHook)
+                return;
+
+            lua_Debug debug;
+            HookState* state = findHookState(luaState);
+            if (state->sampler != nullptr && lua_getstack(luaState, 0, &debug) == 0)
+                state->sampler->callStarted();
+        }
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Measures time spent in bound C++ function while profiler is running
+        class NativeCall
+        {
+            lua_State* m_luaState;
+            const void* m_function = nullptr;
+            std::chrono::steady_clock::time_point m_start;
+
+            /// Hook state stays in registry as long as Lua state, it is nullptr when profiler isn't running
+            HookState* m_state = nullptr;
+
+        public:
+
+            explicit NativeCall(lua_State* luaState)
+                : m_luaState(luaState)
+            {
+                if (lua_gethook(luaState) != &countHook)
+                    return;
+
+                HookState* state = findHookState(luaState);
+                if (state->sampler == nullptr)
+                    return;
+
+                m_state = state;
+                m_function = lua_touserdata(luaState, lua_upvalueindex(1));
+                m_start = std::chrono::steady_clock::now();
+            }
+
+            ~NativeCall()
+            {
+                // Profiler could be stopped by called function
+                if (m_state != nullptr && m_state->sampler != nullptr)
+                    m_state->sampler->nativeCall(m_luaState, m_function, m_start);
+            }
+
+            NativeCall(const NativeCall&) = delete;
+            NativeCall& operator=(const NativeCall&) = delete;
+        };
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Limits protected calls made while guard exists: doString, doFile, lua::Value::call, lua::Chunk::call and
+    /// lua::Coroutine::resume. They share one budget, so code executed under guard can't exceed it in total. Guard takes
+    /// precedence over budget of lua::State and nested guard replaces outer one until it is destroyed.
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// {
+    ///     lua::BudgetGuard guard(state.getState(), lua::ExecutionBudget(1000000, std::chrono::milliseconds(50)));
+    ///     state.doString(tenantCode);
+    /// }
+    /// ~~~~~~~~~~~~~~~
+    ///
+    class BudgetGuard final
+    {
+        lua_State* m_luaState;
+        detail::HookState::Counters m_previousCounters;
+        bool m_previousGuarded;
+
+    public:
+
+        BudgetGuard(lua_State* luaState, const ExecutionBudget& budget)
+            : m_luaState(luaState)
+        {
+            detail::HookState& state = detail::getHookState(luaState);
+            m_previousCounters = state.counters;
+            m_previousGuarded = state.guarded;
+
+            state.guarded = true;
+            detail::startBudget(luaState, state, budget);
+        }
+
+        ~BudgetGuard()
+        {
+            detail::HookState& state = detail::getHookState(m_luaState);
+            state.counters = m_previousCounters;
+            state.guarded = m_previousGuarded;
+
+            // Counters of state budget are started again by next call
+            if (!state.guarded && state.depth == 0)
+                state.counters = detail::HookState::Counters();
+            detail::scheduleHook(m_luaState, state);
+        }
+
+        BudgetGuard(const BudgetGuard&) = delete;
+        BudgetGuard& operator=(const BudgetGuard&) = delete;
+    };
+}
@@ -0,0 +1,232 @@
+//
+//  LuaChannel.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaSerializer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace lua {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Channel for passing values between Lua states running in different threads. Values are encoded to compact binary
+    /// frames and put to bounded lock-free ring buffer. Any number of threads can send values, but only one thread can
+    /// receive them.
+    ///
+    /// Values can be nil, booleans, numbers, strings and tables of them. Received tables are created presized and they
+    /// are always new tables, but shared and cyclic tables within one value keep their identity.
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// lua::Channel channel(1024);
+    ///
+    /// // Producer thread
+    /// channel.send(producer["result"]);
+    ///
+    /// // Consumer thread
+    /// lua::Value value;
+    /// if (channel.receive(consumer, value))
+    ///     process(value);
+    /// ~~~~~~~~~~~~~~~
+    class Channel final
+    {
+        /// Slot of ring buffer. Sequence tells if slot is free for position, or if it holds frame for position
+        struct Cell
+        {
+            std::atomic<std::size_t> sequence;
+            std::string frame;
+        };
+
+        /// Frames don't share cache line with positions of producers and consumer
+        static const std::size_t CacheLineSize = 64;
+
+        std::unique_ptr<Cell[]> m_cells;
+        std::size_t m_mask;
+
+        char m_padding0[CacheLineSize];
+        std::atomic<std::size_t> m_enqueuePosition;
+        char m_padding1[CacheLineSize - sizeof(std::atomic<std::size_t>)];
+
+        /// Position is changed only by consumer thread, so it is not atomic
+        std::size_t m_dequeuePosition = 0;
+
+        /// Frame which is being received and number of its values which weren't received yet
+        std::string m_frame;
+        const char* m_frameData = nullptr;
+        std::size_t m_frameValues = 0;
+
+        bool push(std::string&& frame)
+        {
+            std::size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+            Cell* cell;
+            for (;;)
+            {
+                cell = &m_cells[position & m_mask];
+                std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+
+                if (difference == 0)
+                {
+                    if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                {
+                    // Consumer didn't release this cell yet, so buffer is full
+                    return false;
+                }
+                else
+                {
+                    position = m_enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->frame = std::move(frame);
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop()
+        {
+            Cell& cell = m_cells[m_dequeuePosition & m_mask];
+            if (cell.sequence.load(std::memory_order_acquire) != m_dequeuePosition + 1)
+                return false;
+
+            // Cell is left empty, so it doesn't hold memory of frames which were already received
+            m_frame = std::move(cell.frame);
+            cell.frame.clear();
+            cell.sequence.store(m_dequeuePosition + m_mask + 1, std::memory_order_release);
+            ++m_dequeuePosition;
+
+            m_frameData = m_frame.data();
+            m_frameValues = static_cast<std::size_t>(detail::serializer::readVarint(m_frameData, m_frame.data() + m_frame.size()));
+            return true;
+        }
+
+        static void encode(const Value& value, std::string& frame)
+        {
+            detail::serializer::Encoder encoder(value.getLuaState(), frame);
+            encoder.encode(value.getStackIndex());
+        }
+
+    public:
+
+        /// @param capacity     Maximum number of frames in channel, it is rounded up to power of two
+        explicit Channel(std::size_t capacity)
+        {
+            std::size_t size = 2;
+            while (size < capacity)
+                size *= 2;
+
+            m_cells.reset(new Cell[size]);
+            m_mask = size - 1;
+            for (std::size_t i = 0; i < size; ++i)
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+
+            m_enqueuePosition.store(0, std::memory_order_relaxed);
+        }
+
+        // Channel is non-copyable
+        Channel(const Channel&) = delete;
+        Channel& operator=(const Channel&) = delete;
+
+        /// Sends one value. Can be called from any thread.
+        ///
+        /// @throws lua::SerializationError When value can't be serialized
+        ///
+        /// @return False when channel is full
+        bool send(const Value& value)
+        {
+            std::string frame;
+            detail::serializer::writeVarint(frame, 1);
+            encode(value, frame);
+            return push(std::move(frame));
+        }
+
+        /// Sends many values in one frame, so they take only one slot of channel. Can be called from any thread.
+        ///
+        /// @throws lua::SerializationError When some value can't be serialized
+        ///
+        /// @param first    Iterator to first lua::Value
+        /// @param last     Iterator after last lua::Value
+        ///
+        /// @return False when channel is full, no value was sent in that case
+        template<typename Iterator>
+        bool sendBatch(Iterator first, Iterator last)
+        {
+            std::string frame;
+            detail::serializer::writeVarint(frame, static_cast<std::uint64_t>(std::distance(first, last)));
+            for (; first != last; ++first)
+                encode(*first, frame);
+            return push(std::move(frame));
+        }
+
+        /// Receives one value to given state. Must be called only from one thread.
+        ///
+        /// @throws lua::SerializationError When frame is malformed
+        ///
+        /// @param state    State where value will be created
+        /// @param value    Received value
+        ///
+        /// @return False when channel is empty
+        bool receive(State& state, Value& value)
+        {
+            while (m_frameValues == 0)
+            {
+                if (!pop())
+                    return false;
+            }
+
+            --m_frameValues;
+            try {
+                detail::serializer::Decoder decoder(state.getState(), m_frameData, m_frame.data() + m_frame.size());
+                decoder.decode();
+                m_frameData = decoder.finish();
+            } catch (...) {
+                m_frameValues = 0;
+                throw;
+            }
+
+            value = state.adoptStackValues(1);
+            return true;
+        }
+
+        /// Receives many values, each value is passed to handler. Must be called only from one thread.
+        ///
+        /// @throws lua::SerializationError When frame is malformed
+        ///
+        /// @param state        State where values will be created
+        /// @param handler      Function called with each received lua::Value
+        /// @param maxValues    Maximum number of received values
+        ///
+        /// @return Number of received values
+        template<typename Handler>
+        std::size_t receiveBatch(State& state, Handler&& handler, std::size_t maxValues = std::numeric_limits<std::size_t>::max())
+        {
+            std::size_t received = 0;
+            Value value;
+            while (received < maxValues && receive(state, value))
+            {
+                handler(value);
+                value = Value();
+                ++received;
+            }
+            return received;
+        }
+
+        /// @return Maximum number of frames in channel
+        std::size_t capacity() const
+        {
+            return m_mask + 1;
+        }
+    };
+}
@@ -0,0 +1,139 @@
+//
+//  LuaChunk.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaException.h"
+#include "LuaValue.h"
+
+namespace lua {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Compiled Lua code created by lua::State::compile. Function is kept in LUA_REGISTRYINDEX, so it can be executed
+    /// many times without parsing source again.
+    ///
+    /// @note Chunk must not outlive lua::State from which it was created
+    class Chunk final
+    {
+        friend class State;
+
+        lua_State* m_luaState = nullptr;
+        detail::DeallocQueue* m_deallocQueue = nullptr;
+        detail::StackItemPool* m_stackItemPool = nullptr;
+
+        /// Key of compiled function in LUA_REGISTRYINDEX
+        int m_refKey = LUA_NOREF;
+
+        /// Constructor for lua::State class. Creates reference to function on top of stack and pops it
+        Chunk(lua_State* luaState, detail::DeallocQueue* deallocQueue, detail::StackItemPool* pool)
+            : m_luaState(luaState)
+            , m_deallocQueue(deallocQueue)
+            , m_stackItemPool(pool)
+            , m_refKey(luaL_ref(luaState, LUA_REGISTRYINDEX))
+        {
+        }
+
+    public:
+
+        /// Enable to initialize empty Chunk, so we can set it up later
+        Chunk() = default;
+
+        ~Chunk()
+        {
+            if (m_luaState != nullptr)
+                luaL_unref(m_luaState, LUA_REGISTRYINDEX, m_refKey);
+        }
+
+        // Chunk is non-copyable, but it can be moved
+        Chunk(const Chunk&) = delete;
+        Chunk& operator=(const Chunk&) = delete;
+
+        Chunk(Chunk&& other)
+            : m_luaState(other.m_luaState)
+            , m_deallocQueue(other.m_deallocQueue)
+            , m_stackItemPool(other.m_stackItemPool)
+            , m_refKey(other.m_refKey)
+        {
+            other.m_luaState = nullptr;
+            other.m_refKey = LUA_NOREF;
+        }
+
+        Chunk& operator=(Chunk&& other)
+        {
+            if (this != &other)
+            {
+                if (m_luaState != nullptr)
+                    luaL_unref(m_luaState, LUA_REGISTRYINDEX, m_refKey);
+
+                m_luaState = other.m_luaState;
+                m_deallocQueue = other.m_deallocQueue;
+                m_stackItemPool = other.m_stackItemPool;
+                m_refKey = other.m_refKey;
+
+                other.m_luaState = nullptr;
+                other.m_refKey = LUA_NOREF;
+            }
+            return *this;
+        }
+
+        /// Executes compiled code. Arguments can be read in Lua code with "..." expression.
+        ///
+        /// @throws lua::RuntimeError       When there is runtime error
+        /// @throws lua::MemoryLimitError   When memory limit was reached
+        ///
+        /// @return Values returned by Lua code
+        template<typename... Ts>
+        Value call(Ts&&... args) const
+        {
+            assert(isInitialized());
+
+            int stackTop = lua_gettop(m_luaState);
+            lua_rawgeti(m_luaState, LUA_REGISTRYINDEX, m_refKey);
+
+            const auto argCount = traits::ValueTraits<std::tuple<Ts...>>::push(m_luaState, std::forward<Ts>(args)...);
+
+            detail::BudgetCall budgetCall(m_luaState);
+            int status = lua_pcall(m_luaState, argCount, LUA_MULTRET, 0);
+            if (status != LUA_OK)
+                detail::throwRuntimeError(m_luaState, status);
+
+            int returnedValues = lua_gettop(m_luaState) - stackTop;
+            return Value(detail::makeStackItem(m_stackItemPool, m_luaState, m_deallocQueue, stackTop, returnedValues, returnedValues > 0 ? returnedValues - 1 : 0));
+        }
+
+        /// Same as call, chunks are always executed in protected mode as in lua::State::doString
+        template<typename... Ts>
+        Value operator()(Ts&&... args) const
+        {
+            return call(std::forward<Ts>(args)...);
+        }
+
+        bool isInitialized() const
+        {
+            return m_luaState != nullptr;
+        }
+
+        /// Pushes compiled function to stack
+        ///
+        /// @return Number of pushed values
+        int push(lua_State* luaState) const
+        {
+            assert(luaState == m_luaState);
+            lua_rawgeti(luaState, LUA_REGISTRYINDEX, m_refKey);
+            return 1;
+        }
+    };
+
+    namespace traits {
+        template<>
+        struct ValueTraits<lua::Chunk>
+        {
+            static inline int push(lua_State* luaState, const lua::Chunk& chunk) {
+                return chunk.push(luaState);
+            }
+        };
+    }
+}
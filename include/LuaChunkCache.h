@@ -0,0 +1,243 @@
+//
+//  LuaChunkCache.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include <lua.hpp>
+
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <process.h>
+#include <stdlib.h>
+#else
+#include <climits>
+#include <cstdlib>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+
+namespace lua {
+
+    namespace detail {
+
+        /// Writer function for lua_dump, which appends chunk to std::string
+        inline int writeToString(lua_State*, const void* data, std::size_t size, void* userData)
+        {
+            static_cast<std::string*>(userData)->append(static_cast<const char*>(data), size);
+            return 0;
+        }
+
+        /// Dumps Lua function from top of stack to binary chunk. Function stays on stack.
+        ///
+        /// @param strip    If true, debug information is removed from chunk
+        ///
+        /// @return Binary chunk, which can be loaded with lua_load
+        inline std::string dumpFunction(lua_State* luaState, bool strip = false)
+        {
+            std::string chunk;
+#if LUA_VERSION_NUM >= 503
+            lua_dump(luaState, &writeToString, &chunk, strip ? 1 : 0);
+#else
+            (void)strip;
+            lua_dump(luaState, &writeToString, &chunk);
+#endif
+            return chunk;
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Cache of compiled Lua files. Files are compiled only once and their binary chunks are stored in cache directory.
+    /// Entries are keyed by canonical file path, modification time, size and Lua version. Stale or corrupt entries are
+    /// recompiled and rewritten automatically.
+    ///
+    /// @note Files are compiled with canonical path as chunk name, because binary chunk keeps name from time when it was
+    /// stored. So error messages and debug information show the same absolute path however the file was named.
+    /// @note Binary chunks are not verified by Lua, so cache directory must not be writable by untrusted users
+    class ChunkCache
+    {
+        /// Header of cache entry, it is followed by source path and binary chunk
+        struct EntryHeader
+        {
+            char magic[4];
+            std::int32_t luaVersion;
+            std::int64_t modificationTime;
+            std::int64_t modificationNanoseconds;
+            std::uint64_t fileSize;
+            std::uint64_t pathLength;
+            std::uint64_t chunkLength;
+        };
+
+        std::string m_directory;
+
+        /// @return Absolute path without symbolic links, so one file has one entry however it is named. Path is returned
+        /// unchanged when it can't be resolved, loading will report the error then.
+        static std::string getCanonicalPath(const std::string& filePath)
+        {
+#if defined(_WIN32)
+            char resolved[_MAX_PATH];
+            if (_fullpath(resolved, filePath.c_str(), _MAX_PATH) != nullptr)
+                return resolved;
+#else
+            char resolved[PATH_MAX];
+            if (realpath(filePath.c_str(), resolved) != nullptr)
+                return resolved;
+#endif
+            return filePath;
+        }
+
+        /// @return Identifier of current process, so processes sharing cache directory don't share temporary files
+        static long getProcessId()
+        {
+#if defined(_WIN32)
+            return static_cast<long>(_getpid());
+#else
+            return static_cast<long>(getpid());
+#endif
+        }
+
+        /// @return Path of cache entry for canonical path of Lua file
+        std::string getCanonicalEntryPath(const std::string& canonicalPath) const
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.luac", static_cast<unsigned long long>(std::hash<std::string>()(canonicalPath)));
+            return m_directory + "/" + name;
+        }
+
+        static bool readHeader(const std::string& filePath, EntryHeader& header)
+        {
+            struct stat info;
+            if (stat(filePath.c_str(), &info) != 0)
+                return false;
+
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, "LSCC", 4);
+            header.luaVersion = LUA_VERSION_NUM;
+            header.modificationTime = static_cast<std::int64_t>(info.st_mtime);
+#if defined(__linux__)
+            header.modificationNanoseconds = static_cast<std::int64_t>(info.st_mtim.tv_nsec);
+#elif defined(__APPLE__)
+            header.modificationNanoseconds = static_cast<std::int64_t>(info.st_mtimespec.tv_nsec);
+#endif
+            header.fileSize = static_cast<std::uint64_t>(info.st_size);
+            header.pathLength = filePath.length();
+            return true;
+        }
+
+        /// Loads chunk from cache entry if it belongs to current version of file
+        ///
+        /// @return true if function was pushed to stack
+        bool loadEntry(lua_State* luaState, const std::string& canonicalPath, const EntryHeader& expected) const
+        {
+            std::ifstream file(getCanonicalEntryPath(canonicalPath), std::ios::binary);
+            if (!file)
+                return false;
+
+            std::string entry((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (entry.length() < sizeof(EntryHeader))
+                return false;
+
+            EntryHeader header;
+            std::memcpy(&header, entry.data(), sizeof(EntryHeader));
+            if (std::memcmp(header.magic, expected.magic, 4) != 0
+                || header.luaVersion != expected.luaVersion
+                || header.modificationTime != expected.modificationTime
+                || header.modificationNanoseconds != expected.modificationNanoseconds
+                || header.fileSize != expected.fileSize
+                || header.pathLength != expected.pathLength
+                || entry.length() != sizeof(EntryHeader) + header.pathLength + header.chunkLength
+                || entry.compare(sizeof(EntryHeader), header.pathLength, canonicalPath) != 0)
+                return false;
+
+            const char* chunk = entry.data() + sizeof(EntryHeader) + header.pathLength;
+            if (luaL_loadbufferx(luaState, chunk, header.chunkLength, ("@" + canonicalPath).c_str(), "b") != LUA_OK)
+            {
+                // Corrupt chunk, we will compile file again
+                lua_pop(luaState, 1);
+                return false;
+            }
+            return true;
+        }
+
+        /// Stores function from top of stack to cache entry. Failures are ignored, file will be compiled next time again.
+        void storeEntry(lua_State* luaState, const std::string& canonicalPath, EntryHeader header) const
+        {
+            std::string chunk = detail::dumpFunction(luaState);
+            header.chunkLength = chunk.length();
+
+            std::string entryPath = getCanonicalEntryPath(canonicalPath);
+            std::string temporaryPath = entryPath + "." + std::to_string(getProcessId()) + "." + std::to_string(reinterpret_cast<std::uintptr_t>(luaState)) + ".tmp";
+            {
+                std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+                file.write(reinterpret_cast<const char*>(&header), sizeof(EntryHeader));
+                file.write(canonicalPath.data(), canonicalPath.length());
+                file.write(chunk.data(), chunk.length());
+                if (!file)
+                {
+                    file.close();
+                    std::remove(temporaryPath.c_str());
+                    return;
+                }
+            }
+
+            // Readers will see either old or new entry
+            if (std::rename(temporaryPath.c_str(), entryPath.c_str()) != 0)
+            {
+                std::remove(entryPath.c_str());
+                if (std::rename(temporaryPath.c_str(), entryPath.c_str()) != 0)
+                    std::remove(temporaryPath.c_str());
+            }
+        }
+
+    public:
+
+        /// @param directory    Existing directory where compiled chunks will be stored
+        explicit ChunkCache(const std::string& directory)
+            : m_directory(directory)
+        {
+        }
+
+        /// @return Directory where compiled chunks are stored
+        const std::string& getDirectory() const
+        {
+            return m_directory;
+        }
+
+        /// @return Path of cache entry for given Lua file
+        std::string getEntryPath(const std::string& filePath) const
+        {
+            return getCanonicalEntryPath(getCanonicalPath(filePath));
+        }
+
+        /// Loads file as Lua function to top of stack. Same as luaL_loadfile, but compiled chunk is taken from cache and
+        /// chunk name is canonical path of file.
+        ///
+        /// @return Status code of luaL_loadfile, when it was not successful error message is on top of stack
+        int load(lua_State* luaState, const std::string& filePath) const
+        {
+            std::string canonicalPath = getCanonicalPath(filePath);
+            EntryHeader header;
+            if (!readHeader(canonicalPath, header))
+                return luaL_loadfile(luaState, filePath.c_str());
+
+            if (loadEntry(luaState, canonicalPath, header))
+                return LUA_OK;
+
+            int status = luaL_loadfile(luaState, canonicalPath.c_str());
+            if (status == LUA_OK)
+                storeEntry(luaState, canonicalPath, header);
+
+            return status;
+        }
+    };
+}
@@ -0,0 +1,405 @@
+//
+//  LuaClass.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaPrimitives.h"
+#include "LuaBudget.h"
+#include "LuaFunctor.h"
+#include "LuaReturn.h"
+#include "Traits.h"
+
+#include <cassert>
+#include <new>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+namespace lua {
+
+    namespace detail {
+
+        /// Unique addresses for each bound class, its tables are stored under them in LUA_REGISTRYINDEX
+        template<typename T>
+        struct ClassKey
+        {
+            static const char metatable;
+            static const char methods;
+            static const char properties;
+        };
+
+        template<typename T>
+        const char ClassKey<T>::metatable = 0;
+
+        template<typename T>
+        const char ClassKey<T>::methods = 0;
+
+        template<typename T>
+        const char ClassKey<T>::properties = 0;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Binding of C++ class, which objects are stored directly in Lua userdata. All objects of the class share one
+    /// metatable, which dispatches methods and properties by their name, so objects don't need any closures. Objects
+    /// are destroyed by garbage collector.
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// state.defineClass<Vector>("Vector")
+    ///     .constructor<double, double>()
+    ///     .method("length", &Vector::length)
+    ///     .property("x", &Vector::x);
+    ///
+    /// state.doString("local v = Vector.new(3, 4); v.x = 6; print(v:length())");
+    /// ~~~~~~~~~~~~~~~
+    template<typename T>
+    class Class
+    {
+        static_assert(alignof(T) <= alignof(detail::MaxAlign), "Class is aligned more than Lua userdata");
+
+        /// Accessor of member variable. It is created once per property and stored in Lua userdata.
+        struct BaseProperty
+        {
+            /// Pushes value of property
+            virtual void get(lua_State* luaState, const T& object) const = 0;
+
+            /// Sets property from value at given index
+            virtual void set(lua_State* luaState, T& object, int index) const = 0;
+        };
+
+        template<typename F>
+        struct Property : BaseProperty
+        {
+            F T::* member;
+
+            explicit Property(F T::* member)
+                : member(member)
+            {
+            }
+
+            void get(lua_State* luaState, const T& object) const override
+            {
+                traits::ValueTraits<F>::push(luaState, object.*member);
+            }
+
+            void set(lua_State* luaState, T& object, int index) const override
+            {
+                object.*member = traits::ValueTraits<F>::read(luaState, index);
+            }
+        };
+
+        lua_State* m_luaState;
+
+        /// Name of class table
+        std::string m_name;
+
+        /// Function for metatable "__index" field. Upvalues are tables of methods and properties
+        static int indexFunction(lua_State* luaState)
+        {
+            lua_pushvalue(luaState, 2);
+            lua_rawget(luaState, lua_upvalueindex(1));
+            if (!lua_isnil(luaState, -1))
+                return 1;
+
+            lua_pushvalue(luaState, 2);
+            lua_rawget(luaState, lua_upvalueindex(2));
+            const BaseProperty* property = static_cast<const BaseProperty*>(lua_touserdata(luaState, -1));
+            const T* object = toObject(luaState, 1);
+            if (property == nullptr || object == nullptr)
+                return 0;
+
+            property->get(luaState, *object);
+            return 1;
+        }
+
+        /// Function for metatable "__newindex" field. Upvalue is table of properties
+        static int newIndexFunction(lua_State* luaState)
+        {
+            lua_pushvalue(luaState, 2);
+            lua_rawget(luaState, lua_upvalueindex(1));
+            const BaseProperty* property = static_cast<const BaseProperty*>(lua_touserdata(luaState, -1));
+            T* object = toObject(luaState, 1);
+            if (property == nullptr || object == nullptr)
+                return luaL_error(luaState, "cannot set field '%s' of object", lua_tostring(luaState, 2));
+
+            property->set(luaState, *object, 3);
+            return 0;
+        }
+
+        /// Function for metatable "__gc" field
+        static int deleteFunction(lua_State* luaState)
+        {
+            static_cast<T*>(lua_touserdata(luaState, 1))->~T();
+            return 0;
+        }
+
+        template<typename... Args, std::size_t... Indexes>
+        static void emplace(lua_State* luaState, std::tuple<Args...>& args, traits::IndexTuple<Indexes...>)
+        {
+            push(luaState, std::move(std::get<Indexes>(args))...);
+        }
+
+        /// Constructs object from arguments, like other bound functions it finishes call only after its C++ objects are
+        /// destroyed, see lua::detail::finishCall
+        template<typename... Args>
+        static int constructFunction(lua_State* luaState)
+        {
+            int pushed = construct<Args...>(luaState);
+            return pushed >= 0 ? pushed : detail::finishCall(luaState, pushed);
+        }
+
+        template<typename... Args>
+        static int construct(lua_State* luaState)
+        {
+            detail::NativeCall nativeCall(luaState);
+            lua_settop(luaState, sizeof...(Args));
+            auto args = stack::get_and_pop<traits::RemoveCVR<Args>...>(luaState, nullptr, nullptr, 1);
+            emplace(luaState, args, typename traits::MakeIndexTuple<Args...>::Type());
+            return 1;
+        }
+
+        /// Calls member function stored in upvalue on object in first argument
+        template<typename Method, typename R, typename... Args>
+        struct MethodCaller
+        {
+            template<std::size_t... Indexes>
+            static R invoke(T& object, Method method, std::tuple<traits::RemoveCVR<Args>...>& args, traits::IndexTuple<Indexes...>)
+            {
+                return (object.*method)(static_cast<Args&&>(std::get<Indexes>(args))...);
+            }
+
+            /// Results of method are pushed like results of other bound functions, so it can raise error or suspend
+            /// calling coroutine, see lua::detail::CallResult
+            static int function(lua_State* luaState)
+            {
+                T* object = toObject(luaState, 1);
+                if (object == nullptr)
+                    return luaL_argerror(luaState, 1, "method called on object of different class");
+
+                int pushed = invokeAndPush(luaState, *object);
+                return pushed >= 0 ? pushed : detail::finishCall(luaState, pushed);
+            }
+
+            static int invokeAndPush(lua_State* luaState, T& object)
+            {
+                detail::NativeCall nativeCall(luaState);
+                lua_settop(luaState, sizeof...(Args) + 1);
+                Method method = *static_cast<Method*>(lua_touserdata(luaState, lua_upvalueindex(1)));
+                auto args = stack::get_and_pop<traits::RemoveCVR<Args>...>(luaState, nullptr, nullptr, 2);
+                return traits::ValueTraits<traits::RemoveCVR<R>>::push(luaState, invoke(object, method, args, typename traits::MakeIndexTuple<Args...>::Type()));
+            }
+        };
+
+        template<typename Method, typename... Args>
+        struct MethodCaller<Method, void, Args...>
+        {
+            template<std::size_t... Indexes>
+            static void invoke(T& object, Method method, std::tuple<traits::RemoveCVR<Args>...>& args, traits::IndexTuple<Indexes...>)
+            {
+                (object.*method)(static_cast<Args&&>(std::get<Indexes>(args))...);
+            }
+
+            static int function(lua_State* luaState)
+            {
+                T* object = toObject(luaState, 1);
+                if (object == nullptr)
+                    return luaL_argerror(luaState, 1, "method called on object of different class");
+
+                detail::NativeCall nativeCall(luaState);
+                lua_settop(luaState, sizeof...(Args) + 1);
+                Method method = *static_cast<Method*>(lua_touserdata(luaState, lua_upvalueindex(1)));
+                auto args = stack::get_and_pop<traits::RemoveCVR<Args>...>(luaState, nullptr, nullptr, 2);
+                invoke(*object, method, args, typename traits::MakeIndexTuple<Args...>::Type());
+                return 0;
+            }
+        };
+
+        template<typename Method, typename R, typename... Args>
+        Class& bindMethod(const std::string& name, Method method)
+        {
+            lua_rawgetp(m_luaState, LUA_REGISTRYINDEX, &detail::ClassKey<T>::methods);
+            lua_pushlstring(m_luaState, name.data(), name.length());
+
+            // Member function pointer is stored as upvalue of C closure
+            new (lua_newuserdata(m_luaState, sizeof(Method))) Method(method);
+            lua_pushcclosure(m_luaState, &MethodCaller<Method, R, Args...>::function, 1);
+
+            lua_rawset(m_luaState, -3);
+            lua_pop(m_luaState, 1);
+            return *this;
+        }
+
+        /// Pushes table with static members of class, it is global value with name of class
+        void pushClassTable(const std::string& name)
+        {
+            lua_getglobal(m_luaState, name.c_str());
+            if (!lua_istable(m_luaState, -1))
+            {
+                lua_pop(m_luaState, 1);
+                lua_newtable(m_luaState);
+                lua_pushvalue(m_luaState, -1);
+                lua_setglobal(m_luaState, name.c_str());
+            }
+        }
+
+        void createMetatable(const std::string& name)
+        {
+            lua_newtable(m_luaState);
+            lua_pushvalue(m_luaState, -1);
+            lua_rawsetp(m_luaState, LUA_REGISTRYINDEX, &detail::ClassKey<T>::methods);
+
+            lua_newtable(m_luaState);
+            lua_pushvalue(m_luaState, -1);
+            lua_rawsetp(m_luaState, LUA_REGISTRYINDEX, &detail::ClassKey<T>::properties);
+
+            lua_createtable(m_luaState, 0, 5);
+
+            lua_pushlstring(m_luaState, name.data(), name.length());
+            lua_setfield(m_luaState, -2, "__name");
+
+            // Lua code can't get or change metatable of objects
+            lua_pushlstring(m_luaState, name.data(), name.length());
+            lua_setfield(m_luaState, -2, "__metatable");
+
+            lua_pushvalue(m_luaState, -3);
+            lua_pushvalue(m_luaState, -3);
+            lua_pushcclosure(m_luaState, &Class::indexFunction, 2);
+            lua_setfield(m_luaState, -2, "__index");
+
+            lua_pushvalue(m_luaState, -2);
+            lua_pushcclosure(m_luaState, &Class::newIndexFunction, 1);
+            lua_setfield(m_luaState, -2, "__newindex");
+
+            if (!std::is_trivially_destructible<T>::value)
+            {
+                lua_pushcfunction(m_luaState, &Class::deleteFunction);
+                lua_setfield(m_luaState, -2, "__gc");
+            }
+
+            lua_rawsetp(m_luaState, LUA_REGISTRYINDEX, &detail::ClassKey<T>::metatable);
+            lua_pop(m_luaState, 2);
+        }
+
+    public:
+
+        /// Creates metatable of class, when it doesn't exist yet in Lua state, and global table with given name for static members
+        ///
+        /// @param luaState     Pointer of Lua state
+        /// @param name         Name of class in Lua
+        Class(lua_State* luaState, const std::string& name)
+            : m_luaState(luaState)
+            , m_name(name)
+        {
+            lua_rawgetp(m_luaState, LUA_REGISTRYINDEX, &detail::ClassKey<T>::metatable);
+            bool defined = lua_istable(m_luaState, -1);
+            lua_pop(m_luaState, 1);
+
+            if (!defined)
+                createMetatable(name);
+
+            pushClassTable(name);
+            lua_pop(m_luaState, 1);
+        }
+
+        /// Binds constructor with given arguments as function "new" of class table
+        template<typename... Args>
+        Class& constructor()
+        {
+            pushClassTable(m_name);
+            lua_pushcfunction(m_luaState, &Class::constructFunction<Args...>);
+            lua_setfield(m_luaState, -2, "new");
+            lua_pop(m_luaState, 1);
+            return *this;
+        }
+
+        /// Binds member function, which is called with colon syntax: object:name(...)
+        template<typename C, typename R, typename... Args>
+        Class& method(const std::string& name, R (C::*method)(Args...))
+        {
+            static_assert(std::is_base_of<C, T>::value, "Method must be member of bound class");
+            return bindMethod<R (C::*)(Args...), R, Args...>(name, method);
+        }
+
+        /// Binds const member function, which is called with colon syntax: object:name(...)
+        template<typename C, typename R, typename... Args>
+        Class& method(const std::string& name, R (C::*method)(Args...) const)
+        {
+            static_assert(std::is_base_of<C, T>::value, "Method must be member of bound class");
+            return bindMethod<R (C::*)(Args...) const, R, Args...>(name, method);
+        }
+
+        /// Binds member variable, which can be read and assigned as field of object
+        template<typename F>
+        Class& property(const std::string& name, F T::* member)
+        {
+            static_assert(std::is_trivially_destructible<Property<F>>::value, "Property is stored without destructor");
+
+            lua_rawgetp(m_luaState, LUA_REGISTRYINDEX, &detail::ClassKey<T>::properties);
+            lua_pushlstring(m_luaState, name.data(), name.length());
+            new (lua_newuserdata(m_luaState, sizeof(Property<F>))) Property<F>(member);
+            lua_rawset(m_luaState, -3);
+            lua_pop(m_luaState, 1);
+            return *this;
+        }
+
+        /// Binds static function or any other callable to class table, it is called with dot syntax: Class.name(...)
+        template<typename F>
+        Class& function(const std::string& name, F&& function)
+        {
+            pushClassTable(m_name);
+            traits::ValueTraits<F>::push(m_luaState, std::forward<F>(function));
+            lua_setfield(m_luaState, -2, name.c_str());
+            lua_pop(m_luaState, 1);
+            return *this;
+        }
+
+        /// Creates new object in Lua userdata and pushes it to stack. Class must be defined in Lua state.
+        ///
+        /// @return Pointer to created object, it is valid until object is collected by Lua
+        template<typename... Args>
+        static T* push(lua_State* luaState, Args&&... args)
+        {
+            void* memory = lua_newuserdata(luaState, sizeof(T));
+            T* object = new (memory) T(std::forward<Args>(args)...);
+
+            lua_rawgetp(luaState, LUA_REGISTRYINDEX, &detail::ClassKey<T>::metatable);
+            assert(lua_istable(luaState, -1));
+            lua_setmetatable(luaState, -2);
+            return object;
+        }
+
+        /// @return Object at given index, or nullptr when value isn't object of this class
+        static T* toObject(lua_State* luaState, int index)
+        {
+            void* memory = lua_touserdata(luaState, index);
+            if (memory == nullptr || !lua_getmetatable(luaState, index))
+                return nullptr;
+
+            lua_rawgetp(luaState, LUA_REGISTRYINDEX, &detail::ClassKey<T>::metatable);
+            bool sameClass = lua_rawequal(luaState, -1, -2) != 0;
+            lua_pop(luaState, 2);
+            return sameClass ? static_cast<T*>(memory) : nullptr;
+        }
+    };
+
+    namespace traits {
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Object of bound class, so bound functions can take objects as arguments. Pointer is nullptr when value isn't
+        /// object of that class. Objects are owned by Lua, so they are created with lua::Class::push and they can't be
+        /// pushed by pointer.
+        ///
+        /// @note Arguments of bound functions are read by value, so objects must be taken as pointers. Reference
+        ///       argument would be bound to a copy of object, which isn't supported.
+        template<typename T>
+        struct ValueTraits<T*, typename std::enable_if<std::is_class<T>::value>::type>
+        {
+            static inline T* read(lua_State* luaState, int index)
+            {
+                return Class<typename std::remove_cv<T>::type>::toObject(luaState, index);
+            }
+        };
+    }
+}
@@ -0,0 +1,249 @@
+//
+//  LuaCoroutine.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaState.h"
+
+#include <memory>
+
+namespace lua {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Lua coroutine driven from C++. Coroutine runs on its own Lua thread created with lua_newthread, so it shares globals
+    /// with lua::State, but it has its own stack. Values returned by resume live on stack of coroutine and they have their
+    /// own deallocation queue, so many coroutines can be suspended at once, each of them costs only Lua thread and few
+    /// bytes of bookkeeping.
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// lua::Coroutine session(state["session"]);
+    ///
+    /// lua::Value request = session.resume(userId);
+    /// while (session.getStatus() == lua::Coroutine::Status::Suspended)
+    ///     request = session.resume(handle(request));
+    /// ~~~~~~~~~~~~~~~
+    ///
+    /// @note Values returned by resume are valid until next resume. Functions returned by resume can't be called
+    /// directly, because Lua doesn't allow calls on suspended thread, pass them to lua::State first.
+    ///
+    /// @note Coroutine must not outlive lua::State from which it was created and values returned by resume must not
+    /// outlive coroutine
+    class Coroutine final
+    {
+    public:
+
+        enum class Status
+        {
+            /// Coroutine wasn't started yet or it yielded
+            Suspended,
+
+            /// Coroutine is being resumed
+            Running,
+
+            /// Function of coroutine returned
+            Finished,
+
+            /// Function of coroutine raised error
+            Failed,
+        };
+
+    private:
+
+        /// Main thread of Lua state, which keeps reference to coroutine thread
+        lua_State* m_luaState = nullptr;
+
+        lua_State* m_thread = nullptr;
+
+        /// Key of coroutine thread in LUA_REGISTRYINDEX, it keeps thread from garbage collection
+        int m_refKey = LUA_NOREF;
+
+        /// Bookkeeping of values on stack of coroutine
+        std::unique_ptr<detail::DeallocQueue> m_deallocQueue;
+        std::unique_ptr<detail::StackItemPool> m_stackItemPool;
+
+        /// Stack item of values returned by last resume
+        detail::StackItemPtr m_results;
+
+        Status m_status = Status::Suspended;
+
+        /// Removes values returned by last resume from stack of coroutine
+        void releaseResults()
+        {
+            if (!m_results)
+                return;
+
+            // Values which are still used by caller won't touch stack of coroutine anymore
+            if (m_results->refCount > 1)
+                m_results->deallocQueue = nullptr;
+
+            // Other values created on stack of coroutine must be released before results
+            assert(lua_gettop(m_thread) == m_results->top + m_results->pushed);
+
+            m_results = nullptr;
+            m_deallocQueue->clear();
+            lua_settop(m_thread, 0);
+        }
+
+        void reset()
+        {
+            m_results = nullptr;
+            if (m_luaState != nullptr)
+                luaL_unref(m_luaState, LUA_REGISTRYINDEX, m_refKey);
+
+            m_luaState = nullptr;
+            m_thread = nullptr;
+            m_refKey = LUA_NOREF;
+        }
+
+    public:
+
+        /// Enable to initialize empty Coroutine, so we can set it up later
+        Coroutine() = default;
+
+        /// Creates suspended coroutine, which will call given function when it is resumed first time
+        ///
+        /// @param function     Lua function or other callable value
+        explicit Coroutine(const Value& function)
+            : m_deallocQueue(new detail::DeallocQueue())
+            , m_stackItemPool(new detail::StackItemPool())
+        {
+            lua_State* luaState = function.getLuaState();
+
+            // Reference is kept by main thread, because function could be created on stack of other coroutine
+            lua_rawgeti(luaState, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+            m_luaState = lua_tothread(luaState, -1);
+            lua_pop(luaState, 1);
+
+            m_thread = lua_newthread(luaState);
+            lua_pushvalue(luaState, function.getStackIndex());
+            lua_xmove(luaState, m_thread, 1);
+            m_refKey = luaL_ref(luaState, LUA_REGISTRYINDEX);
+        }
+
+        ~Coroutine()
+        {
+            reset();
+        }
+
+        // Coroutine is non-copyable, but it can be moved
+        Coroutine(const Coroutine&) = delete;
+        Coroutine& operator=(const Coroutine&) = delete;
+
+        Coroutine(Coroutine&& other)
+            : m_luaState(other.m_luaState)
+            , m_thread(other.m_thread)
+            , m_refKey(other.m_refKey)
+            , m_deallocQueue(std::move(other.m_deallocQueue))
+            , m_stackItemPool(std::move(other.m_stackItemPool))
+            , m_results(std::move(other.m_results))
+            , m_status(other.m_status)
+        {
+            other.m_luaState = nullptr;
+            other.m_thread = nullptr;
+            other.m_refKey = LUA_NOREF;
+        }
+
+        Coroutine& operator=(Coroutine&& other)
+        {
+            if (this != &other)
+            {
+                reset();
+
+                m_luaState = other.m_luaState;
+                m_thread = other.m_thread;
+                m_refKey = other.m_refKey;
+                m_deallocQueue = std::move(other.m_deallocQueue);
+                m_stackItemPool = std::move(other.m_stackItemPool);
+                m_results = std::move(other.m_results);
+                m_status = other.m_status;
+
+                other.m_luaState = nullptr;
+                other.m_thread = nullptr;
+                other.m_refKey = LUA_NOREF;
+            }
+            return *this;
+        }
+
+        /// Starts coroutine or continues it after yield. First resume passes arguments to function of coroutine, next
+        /// resumes pass them as results of coroutine.yield.
+        ///
+        /// @throws lua::RuntimeError           When coroutine raises error or it can't be resumed
+        /// @throws lua::MemoryLimitError       When memory limit was reached
+        /// @throws lua::ExecutionLimitError    When execution budget was exceeded
+        ///
+        /// @return Values passed to coroutine.yield, or values returned by function when coroutine finished
+        template<typename... Ts>
+        Value resume(Ts&&... args)
+        {
+            assert(isInitialized());
+
+            if (m_status != Status::Suspended)
+            {
+                lua_pushstring(m_thread, m_status == Status::Running ? "cannot resume non-suspended coroutine" : "cannot resume dead coroutine");
+                throw RuntimeError(m_thread);
+            }
+
+            releaseResults();
+
+            luaL_checkstack(m_thread, static_cast<int>(sizeof...(Ts)), nullptr);
+            const auto argCount = traits::ValueTraits<std::tuple<Ts...>>::push(m_thread, std::forward<Ts>(args)...);
+
+            m_status = Status::Running;
+            int status;
+            int returnedValues = 0;
+            {
+                // Resume is protected call, so it has execution budget of lua::State
+                detail::BudgetCall budgetCall(m_thread, m_luaState);
+#if LUA_VERSION_NUM >= 504
+                status = lua_resume(m_thread, m_luaState, argCount, &returnedValues);
+#else
+                status = lua_resume(m_thread, m_luaState, argCount);
+                returnedValues = lua_gettop(m_thread);
+#endif
+            }
+            if (status == LUA_YIELD)
+            {
+                m_status = Status::Suspended;
+            }
+            else if (status == LUA_OK)
+            {
+                m_status = Status::Finished;
+            }
+            else
+            {
+                m_status = Status::Failed;
+                detail::throwRuntimeError(m_thread, status);
+            }
+
+            int stackTop = lua_gettop(m_thread) - returnedValues;
+            m_results = detail::makeStackItem(m_stackItemPool.get(), m_thread, m_deallocQueue.get(), stackTop, returnedValues, returnedValues > 0 ? returnedValues - 1 : 0);
+            return Value(detail::StackItemPtr(m_results));
+        }
+
+        /// @return State of coroutine
+        Status getStatus() const
+        {
+            return m_status;
+        }
+
+        /// @return True when coroutine can be resumed
+        bool isResumable() const
+        {
+            return isInitialized() && m_status == Status::Suspended;
+        }
+
+        bool isInitialized() const
+        {
+            return m_thread != nullptr;
+        }
+
+        /// @return Lua thread of coroutine
+        lua_State* getThread() const
+        {
+            return m_thread;
+        }
+    };
+}
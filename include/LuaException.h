@@ -86,6 +86,48 @@ namespace lua {
         }
     };
 
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Lua state could not allocate memory, usually because memory limit of lua::State was reached
+    class MemoryLimitError : public RuntimeError
+    {
+    public:
+        explicit MemoryLimitError(lua_State* luaState)
+            : RuntimeError{ luaState }
+        {
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Script exceeded its execution budget, see lua::ExecutionBudget
+    class ExecutionLimitError : public RuntimeError
+    {
+    public:
+        
+        enum class Limit
+        {
+            Instructions,
+            Deadline,
+        };
+        
+    private:
+        
+        Limit m_limit;
+        
+    public:
+        
+        ExecutionLimitError(lua_State* luaState, Limit limit)
+            : RuntimeError{ luaState }
+            , m_limit(limit)
+        {
+        }
+        
+        /// @return Limit which was exceeded
+        Limit getLimit() const
+        {
+            return m_limit;
+        }
+    };
+
     //////////////////////////////////////////////////////////////////////////////////////////////
     class TypeMismatchError : public ExceptionBase
     {
@@ -95,4 +137,69 @@ namespace lua {
         {
         }
     };
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Value can't be serialized, or serialized data are malformed
+    class SerializationError : public ExceptionBase
+    {
+    public:
+        explicit SerializationError(const std::string& message)
+            : ExceptionBase{ message }
+        {
+        }
+    };
+
+    namespace detail {
+        
+        /// Addresses of these variables are raised as Lua errors when execution budget is exceeded
+        template<typename T = void>
+        struct ExecutionLimitKey
+        {
+            static const char instructions;
+            static const char deadline;
+        };
+        
+        template<typename T>
+        const char ExecutionLimitKey<T>::instructions = 0;
+        
+        template<typename T>
+        const char ExecutionLimitKey<T>::deadline = 0;
+        
+        /// Throws exception for error status returned from lua_pcall. Error message must be on top of stack
+        ///
+        /// @throws lua::MemoryLimitError       When status is LUA_ERRMEM
+        /// @throws lua::ExecutionLimitError    When execution budget was exceeded
+        /// @throws lua::RuntimeError           Otherwise
+        [[noreturn]] inline void throwRuntimeError(lua_State* luaState, int status)
+        {
+            if (status == LUA_ERRMEM)
+                throw MemoryLimitError(luaState);
+            
+            if (lua_type(luaState, -1) == LUA_TLIGHTUSERDATA)
+            {
+                const void* key = lua_touserdata(luaState, -1);
+                if (key == &ExecutionLimitKey<>::instructions || key == &ExecutionLimitKey<>::deadline)
+                {
+                    bool deadline = key == &ExecutionLimitKey<>::deadline;
+                    lua_pop(luaState, 1);
+                    lua_pushstring(luaState, deadline ? "deadline of execution exceeded" : "instruction limit exceeded");
+                    throw ExecutionLimitError(luaState, deadline ? ExecutionLimitError::Limit::Deadline : ExecutionLimitError::Limit::Instructions);
+                }
+            }
+            
+            throw RuntimeError(luaState);
+        }
+        
+        /// Throws exception for error status returned from luaL_load* functions. Error message must be on top of stack
+        ///
+        /// @throws lua::MemoryLimitError   When status is LUA_ERRMEM
+        /// @throws lua::LoadError          Otherwise
+        [[noreturn]] inline void throwLoadError(lua_State* luaState, int status)
+        {
+            if (status == LUA_ERRMEM)
+                throw MemoryLimitError(luaState);
+            
+            throw LoadError(luaState);
+        }
+    }
 }
@@ -9,15 +9,181 @@
 
 #pragma once
 
+#include "LuaPrimitives.h"
+#include "LuaBudget.h"
 #include "LuaReturn.h"
 
 #include <functional>
+#include <new>
+#include <tuple>
 #include <type_traits>
 
 namespace lua {
-    
+
+    namespace detail {
+
+        /// Unique address for each bound callable type, its metatable is stored under it in LUA_REGISTRYINDEX
+        template<typename F>
+        struct FunctorKey
+        {
+            static const char metatable;
+        };
+
+        template<typename F>
+        const char FunctorKey<F>::metatable = 0;
+
+        /// Negative results of ValueTraits::push of bound function result, which ask trampoline to finish call after
+        /// all C++ objects of call are destroyed, because Lua leaves C function with longjmp in these cases
+        enum CallResult : int
+        {
+            /// Error message was pushed to stack and it will be raised as Lua error
+            CallRaiseError = -1,
+
+            /// Calling coroutine will be suspended, see lua::Task
+            CallSuspend = -2,
+        };
+
+#if LUA_VERSION_NUM >= 503
+        /// Continuation of suspended bound function. Coroutine is resumed with success flag followed by results, or
+        /// by error message when awaited operation failed
+        inline int resumeCall(lua_State* luaState, int, lua_KContext)
+        {
+            if (!lua_toboolean(luaState, 1))
+                return lua_error(luaState);
+
+            return lua_gettop(luaState) - 1;
+        }
+#endif
+
+        inline int finishCall(lua_State* luaState, int result)
+        {
+#if LUA_VERSION_NUM >= 503
+            if (result == CallSuspend)
+                return lua_yieldk(luaState, 0, 0, &resumeCall);
+#endif
+            return lua_error(luaState);
+        }
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Trampoline of C closure which calls callable of type F. Callable is stored directly in userdata memory,
+        /// which is first upvalue of closure, so there is no virtual call or copying of callable.
+        template<typename F, typename Ret, typename... Args>
+        struct Functor
+        {
+            template<std::size_t... Indexes>
+            static Ret invoke(F& function, std::tuple<traits::RemoveCVR<Args>...>& args, traits::IndexTuple<Indexes...>)
+            {
+                return function(static_cast<Args&&>(std::get<Indexes>(args))...);
+            }
+
+            /// Function with lua_CFunction signature
+            ///
+            /// @note In Lua C API during function calls, lua_State has its own stack, where arguments are pushed from first position
+            static int call(lua_State* luaState)
+            {
+                int pushed = invokeAndPush(luaState);
+                return pushed >= 0 ? pushed : finishCall(luaState, pushed);
+            }
+
+        private:
+
+            static int invokeAndPush(lua_State* luaState)
+            {
+                detail::NativeCall nativeCall(luaState);
+
+                // In Lua numbers of argumens can be different, we will ignore overlapping ones
+                if (lua_gettop(luaState) > static_cast<int>(sizeof...(Args)))
+                    lua_settop(luaState, sizeof...(Args));
+
+                F& function = *static_cast<F*>(lua_touserdata(luaState, lua_upvalueindex(1)));
+                auto args = stack::get_and_pop<traits::RemoveCVR<Args>...>(luaState, nullptr, nullptr, 1);
+                return push(luaState, function, args, std::is_void<Ret>());
+            }
+
+            static int push(lua_State* luaState, F& function, std::tuple<traits::RemoveCVR<Args>...>& args, std::false_type)
+            {
+                return traits::ValueTraits<traits::RemoveCVR<Ret>>::push(luaState, invoke(function, args, typename traits::MakeIndexTuple<Args...>::Type()));
+            }
+
+            static int push(lua_State*, F& function, std::tuple<traits::RemoveCVR<Args>...>& args, std::true_type)
+            {
+                invoke(function, args, typename traits::MakeIndexTuple<Args...>::Type());
+                return 0;
+            }
+        };
+
+        /// Function for metatable "__gc" field of callables with destructor
+        template<typename F>
+        int deleteFunctor(lua_State* luaState)
+        {
+            static_cast<F*>(lua_touserdata(luaState, 1))->~F();
+            return 0;
+        }
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Signature of member function, which is used to get arguments of operator() of lambdas and function objects
+        template<typename T>
+        struct MemberSignature;
+
+        template<typename C, typename R, typename... Args>
+        struct MemberSignature<R (C::*)(Args...)>
+        {
+            using Type = R(Args...);
+        };
+
+        template<typename C, typename R, typename... Args>
+        struct MemberSignature<R (C::*)(Args...) const>
+        {
+            using Type = R(Args...);
+        };
+
+#ifdef __cpp_noexcept_function_type
+        template<typename C, typename R, typename... Args>
+        struct MemberSignature<R (C::*)(Args...) noexcept>
+        {
+            using Type = R(Args...);
+        };
+
+        template<typename C, typename R, typename... Args>
+        struct MemberSignature<R (C::*)(Args...) const noexcept>
+        {
+            using Type = R(Args...);
+        };
+#endif
+
+        template<typename... Ts>
+        struct MakeVoid
+        {
+            using Type = void;
+        };
+
+        /// Checks if T is class with single non-template operator(), for example lambda or std::function
+        template<typename T, typename Enable = void>
+        struct IsFunctionObject : std::false_type
+        {
+        };
+
+        template<typename T>
+        struct IsFunctionObject<T, typename MakeVoid<decltype(&T::operator())>::Type> : std::is_class<T>
+        {
+        };
+
+        /// std::function has its own ValueTraits, which other code can refer to
+        template<typename T>
+        struct IsStdFunction : std::false_type
+        {
+        };
+
+        template<typename Signature>
+        struct IsStdFunction<std::function<Signature>> : std::true_type
+        {
+        };
+    }
+
     //////////////////////////////////////////////////////////////////////////////////////////////
-    /// Base functor class with call function. It is used for registering lamdas, or regular functions
+    /// Base of functors which are stored by pointer in userdata with "luaL_Functor" metatable, it is registered in each
+    /// lua::State. Bound callables are C closures now, see lua::detail::Functor, this is kept for code which pushes
+    /// its own functors.
     struct BaseFunctor
     {
         template<typename Ret, typename... Args, size_t... Indexes >
@@ -32,42 +198,70 @@ namespace lua {
             return callHelper(pf, std::forward<std::tuple<Args...>>(tup), typename traits::MakeIndexTuple<Args...>::Type());
         }
 
-
         explicit BaseFunctor() = default;
-        
+
         virtual ~BaseFunctor() noexcept = default;
-        
+
         /// In Lua numbers of argumens can be different so here we will handle these situations.
         ///
         /// @param luaState     Pointer of Lua state
         inline void prepareFunctionCall(lua_State* luaState, int requiredValues) {
-            
+
             // First item is our pushed userdata
             if (lua_gettop(luaState) > requiredValues + 1) {
                 lua_settop(luaState, requiredValues + 1);
             }
         }
-        
+
         /// Virtual function that will make Lua call to our functor.
         ///
         /// @param luaState     Pointer of Lua state
         virtual int call(lua_State* luaState) = 0;
+
+        /// Function for metatable "__call" field. It calls stored functor pushes return values to stack.
+        static int metatableCallFunction(lua_State* luaState)
+        {
+            BaseFunctor* functor = *static_cast<BaseFunctor**>(luaL_checkudata(luaState, 1, "luaL_Functor"));
+            return functor->call(luaState);
+        }
+
+        /// Function for metatable "__gc" field. It deletes captured variables from stored functors.
+        static int metatableDeleteFunction(lua_State* luaState)
+        {
+            BaseFunctor* functor = *static_cast<BaseFunctor**>(luaL_checkudata(luaState, 1, "luaL_Functor"));
+            delete functor;
+            return 0;
+        }
+
+        /// Creates "luaL_Functor" metatable in LUA_REGISTRYINDEX
+        static void registerMetatable(lua_State* luaState)
+        {
+            luaL_newmetatable(luaState, "luaL_Functor");
+
+            lua_pushcfunction(luaState, &BaseFunctor::metatableCallFunction);
+            lua_setfield(luaState, -2, "__call");
+
+            lua_pushcfunction(luaState, &BaseFunctor::metatableDeleteFunction);
+            lua_setfield(luaState, -2, "__gc");
+
+            lua_pop(luaState, 1);
+        }
     };
-    
+
     //////////////////////////////////////////////////////////////////////////////////////////////
     /// Functor with return values
     template<typename Ret, typename ... Args>
     struct Functor : public BaseFunctor
     {
         std::function<Ret(Args...)> function;
-        
+
         /// Constructor creates functor to be pushed to Lua interpret
         explicit Functor(std::function<Ret(Args...)> function)
             : BaseFunctor()
             , function(function)
         {
         }
-        
+
         /// We will make Lua call to our functor.
         ///
         /// @note When we call function from Lua to C, they have their own stack, where in the first position is our binded userdata and next position are pushed arguments
@@ -75,25 +269,25 @@ namespace lua {
         /// @param luaState     Pointer of Lua state
         int call(lua_State* luaState) override
         {
-            Ret value = BaseFunctor::call(function, stack::get_and_pop<Args...>(luaState, nullptr, 2));
+            Ret value = BaseFunctor::call(function, stack::get_and_pop<Args...>(luaState, nullptr, nullptr, 2));
             return traits::ValueTraits<Ret>::push(luaState, std::forward<Ret>(value));
         }
     };
-    
+
     //////////////////////////////////////////////////////////////////////////////////////////////
     /// Functor with no return values
     template <typename ... Args>
     struct Functor<void, Args...> : public BaseFunctor
     {
         std::function<void(Args...)> function;
-        
+
         /// Constructor creates functor to be pushed to Lua interpret
         explicit Functor(std::function<void(Args...)> function)
             : BaseFunctor()
             , function(function)
         {
         }
-        
+
         /// We will make Lua call to our functor.
         ///
         /// @note When we call function from Lua to C, they have their own stack, where in the first position is our binded userdata and next position are pushed arguments
@@ -101,33 +295,68 @@ namespace lua {
         /// @param luaState     Pointer of Lua state
         int call(lua_State* luaState) override
         {
-            BaseFunctor::call(function, stack::get_and_pop<Args...>(luaState, nullptr, 2));
+            BaseFunctor::call(function, stack::get_and_pop<Args...>(luaState, nullptr, nullptr, 2));
             return 0;
         }
     };
 
     namespace traits
     {
-        template<typename Ret, typename... Args>
-        struct ValueTraits<std::function<Ret(Args...)>>
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Pushes callable of type F with given signature as C closure. Captured variables are managed by Lua garbage collector.
+        template<typename F, typename Signature>
+        struct FunctorTraits;
+
+        template<typename F, typename Ret, typename... Args>
+        struct FunctorTraits<F, Ret(Args...)>
         {
-            static inline int push(lua_State* luaState, std::function<Ret(Args...)> function) {
-                BaseFunctor** udata{ static_cast<BaseFunctor**>( lua_newuserdata(luaState, sizeof(BaseFunctor *)) ) };
-                *udata = new Functor<Ret, traits::RemoveCVR<Args>...>(function);
+            static_assert(alignof(F) <= alignof(detail::MaxAlign), "Callable is aligned more than Lua userdata");
 
-                luaL_getmetatable(luaState, "luaL_Functor");
-                lua_setmetatable(luaState, -2);
+            template<typename Callable>
+            static inline int push(lua_State* luaState, Callable&& function)
+            {
+                new (lua_newuserdata(luaState, sizeof(F))) F(std::forward<Callable>(function));
+
+                // Only callables with destructor need metatable, it is shared by all callables of same type
+                if (!std::is_trivially_destructible<F>::value)
+                {
+                    lua_rawgetp(luaState, LUA_REGISTRYINDEX, &detail::FunctorKey<F>::metatable);
+                    if (lua_isnil(luaState, -1))
+                    {
+                        lua_pop(luaState, 1);
+                        lua_createtable(luaState, 0, 1);
+                        lua_pushcfunction(luaState, &detail::deleteFunctor<F>);
+                        lua_setfield(luaState, -2, "__gc");
+                        lua_pushvalue(luaState, -1);
+                        lua_rawsetp(luaState, LUA_REGISTRYINDEX, &detail::FunctorKey<F>::metatable);
+                    }
+                    lua_setmetatable(luaState, -2);
+                }
+
+                lua_pushcclosure(luaState, &detail::Functor<F, Ret, Args...>::call, 1);
                 return 1;
             }
         };
 
+        /// Lambdas and other function objects
+        template<typename F>
+        struct ValueTraits<F, typename std::enable_if<detail::IsFunctionObject<F>::value && !detail::IsStdFunction<F>::value>::type>
+            : FunctorTraits<F, typename detail::MemberSignature<decltype(&F::operator())>::Type>
+        {
+        };
+
+        template<typename Ret, typename... Args>
+        struct ValueTraits<std::function<Ret(Args...)>> : FunctorTraits<std::function<Ret(Args...)>, Ret(Args...)>
+        {
+        };
+
         template<typename Ret, typename... Args>
-        struct ValueTraits<Ret(Args...)> : ValueTraits<std::function<Ret(Args...)>>
+        struct ValueTraits<Ret(*)(Args...)> : FunctorTraits<Ret(*)(Args...), Ret(Args...)>
         {
         };
 
         template<typename Ret, typename... Args>
-        struct ValueTraits<Ret(*)(Args...)> : ValueTraits<std::function<Ret(Args...)>>
+        struct ValueTraits<Ret(Args...)> : ValueTraits<Ret(*)(Args...)>
         {
         };
 
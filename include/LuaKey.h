@@ -0,0 +1,124 @@
+//
+//  LuaKey.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "Traits.h"
+
+#include <cassert>
+#include <string>
+#include <utility>
+
+namespace lua {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// String key, which is interned only once with lua::State::createKey. Lua string is kept in LUA_REGISTRYINDEX,
+    /// so indexing tables with key doesn't need to hash string or compute its length again.
+    ///
+    /// @note Key must not outlive lua::State from which it was created
+    class Key final
+    {
+        friend class State;
+
+        lua_State* m_luaState = nullptr;
+
+        /// Key of interned string in LUA_REGISTRYINDEX
+        int m_refKey = LUA_NOREF;
+
+        /// Constructor for lua::State class. Interns given string
+        Key(lua_State* luaState, const std::string& name)
+            : m_luaState(luaState)
+        {
+            lua_pushlstring(luaState, name.data(), name.length());
+            m_refKey = luaL_ref(luaState, LUA_REGISTRYINDEX);
+        }
+
+        void release()
+        {
+            if (m_luaState != nullptr)
+                luaL_unref(m_luaState, LUA_REGISTRYINDEX, m_refKey);
+        }
+
+    public:
+
+        /// Enable to initialize empty Key, so we can set it up later
+        Key() = default;
+
+        ~Key()
+        {
+            release();
+        }
+
+        Key(const Key& other)
+            : m_luaState(other.m_luaState)
+        {
+            if (m_luaState != nullptr)
+            {
+                other.push(m_luaState);
+                m_refKey = luaL_ref(m_luaState, LUA_REGISTRYINDEX);
+            }
+        }
+
+        Key(Key&& other)
+            : m_luaState(other.m_luaState)
+            , m_refKey(other.m_refKey)
+        {
+            other.m_luaState = nullptr;
+            other.m_refKey = LUA_NOREF;
+        }
+
+        Key& operator=(Key other)
+        {
+            std::swap(m_luaState, other.m_luaState);
+            std::swap(m_refKey, other.m_refKey);
+            return *this;
+        }
+
+        bool isInitialized() const
+        {
+            return m_luaState != nullptr;
+        }
+
+        /// @return Interned string
+        std::string toString() const
+        {
+            push(m_luaState);
+            std::size_t length = 0;
+            const char* name = lua_tolstring(m_luaState, -1, &length);
+            std::string result(name, length);
+            lua_pop(m_luaState, 1);
+            return result;
+        }
+
+        /// Pushes interned string to stack
+        ///
+        /// @return Number of pushed values
+        int push(lua_State* luaState) const
+        {
+            assert(isInitialized());
+            lua_rawgeti(luaState, LUA_REGISTRYINDEX, m_refKey);
+            return 1;
+        }
+    };
+
+    namespace traits {
+        template<>
+        struct ValueTraits<lua::Key>
+        {
+            static inline void get(lua_State* luaState, int index, const lua::Key& key)
+            {
+                index = lua_absindex(luaState, index);
+                key.push(luaState);
+                lua_gettable(luaState, index);
+            }
+
+            static inline int push(lua_State* luaState, const lua::Key& key)
+            {
+                return key.push(luaState);
+            }
+        };
+    }
+}
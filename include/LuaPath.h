@@ -0,0 +1,274 @@
+//
+//  LuaPath.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaKey.h"
+#include "LuaValue.h"
+
+#include <tuple>
+#include <type_traits>
+
+namespace lua {
+
+    namespace detail {
+
+        /// Defines how key of lua::Path is stored until path is evaluated
+        template<typename K>
+        struct PathKey
+        {
+            using Type = K;
+
+            template<typename T>
+            static Type store(T&& key)
+            {
+                return Type(std::forward<T>(key));
+            }
+
+            static void get(lua_State* luaState, const Type& key)
+            {
+                traits::ValueTraits<K>::get(luaState, -1, key);
+            }
+        };
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Lazy lookup to nested tables created by lua::Value::operator[]. Keys are only stored and the path is walked when
+    /// it is read, set or called. Whole path is walked in single stack slot, which is popped right after use, so deep
+    /// lookups don't leave any values in stack.
+    ///
+    /// @note Path is evaluated again every time it is used. Convert it to lua::Value when you want to use the same value many times.
+    /// @note Keys are copied to path. Copy of lua::Key creates new registry reference, so move keys which aren't needed anymore
+    template<typename... Keys>
+    class Path : public detail::ValueAccessors<Path<Keys...>>
+    {
+        friend class Value;
+        template<typename... Ts> friend class Path;
+
+        /// Table where path starts
+        Value m_root;
+
+        std::tuple<typename detail::PathKey<Keys>::Type...> m_keys;
+
+        /// Pops evaluated value from stack when it goes out of scope
+        struct PopGuard
+        {
+            lua_State* luaState;
+
+            ~PopGuard()
+            {
+                lua_pop(luaState, 1);
+            }
+        };
+
+        Path(const Value& root, std::tuple<typename detail::PathKey<Keys>::Type...>&& keys)
+            : m_root(root)
+            , m_keys(std::move(keys))
+        {
+        }
+
+        lua_State* getLuaState() const
+        {
+            return m_root.m_stack->state;
+        }
+
+        template<std::size_t... Indexes>
+        void walk(traits::IndexTuple<Indexes...>) const
+        {
+            lua_State* luaState = getLuaState();
+
+            // Each lookup replaces table with its field
+            using Expander = int[];
+            (void)Expander{ 0, (detail::PathKey<Keys>::get(luaState, std::get<Indexes>(m_keys)), lua_replace(luaState, -2), 0)... };
+        }
+
+        template<typename T>
+        T read(T*) const
+        {
+            push(getLuaState());
+            PopGuard guard{ getLuaState() };
+            return traits::ValueTraits<T>::read(getLuaState(), -1);
+        }
+
+        Value read(Value*) const
+        {
+            int stackTop = lua_gettop(getLuaState());
+            push(getLuaState());
+            return Value(detail::makeStackItem(m_root.m_stack->pool, getLuaState(), m_root.m_stack->deallocQueue, stackTop, 1, 0));
+        }
+
+        template<typename... Ts>
+        Value executeFunction(bool protectedCall, Ts&&... args) const
+        {
+            int stackTop = lua_gettop(getLuaState());
+            push(getLuaState());
+
+            // Function is popped by call, so only returned values stay in stack
+            m_root.callFunction(protectedCall, std::forward<Ts>(args)...);
+            int returnedValues = lua_gettop(getLuaState()) - stackTop;
+
+            return Value(detail::makeStackItem(m_root.m_stack->pool, getLuaState(), m_root.m_stack->deallocQueue, stackTop, returnedValues, returnedValues == 0 ? 0 : returnedValues - 1));
+        }
+
+    public:
+
+        using detail::ValueAccessors<Path<Keys...>>::set;
+
+        /// Extends path with next key
+        template<typename T>
+        Path<Keys..., typename std::decay<T>::type> operator[](T&& key) const &
+        {
+            using NextKey = detail::PathKey<typename std::decay<T>::type>;
+            return Path<Keys..., typename std::decay<T>::type>(m_root, std::tuple_cat(m_keys, std::make_tuple(NextKey::store(std::forward<T>(key)))));
+        }
+
+        /// Extends temporary path with next key, its keys are moved to new path
+        template<typename T>
+        Path<Keys..., typename std::decay<T>::type> operator[](T&& key) &&
+        {
+            using NextKey = detail::PathKey<typename std::decay<T>::type>;
+            return Path<Keys..., typename std::decay<T>::type>(m_root, std::tuple_cat(std::move(m_keys), std::make_tuple(NextKey::store(std::forward<T>(key)))));
+        }
+
+        /// Evaluates path and creates lua::Value, which keeps value in stack
+        operator Value() const
+        {
+            return read(static_cast<Value*>(nullptr));
+        }
+
+        /// Call value at the end of path
+        ///
+        /// @note This function doesn't check if value is lua::Callable. You must use is<lua::Callable>() function if you want to be sure
+        template<typename... Ts>
+        Value operator()(Ts&&... args) const
+        {
+            return executeFunction(false, std::forward<Ts>(args)...);
+        }
+
+        /// Protected call of value at the end of path
+        ///
+        /// @note This function doesn't check if value is lua::Callable. You must use is<lua::Callable>() function if you want to be sure
+        template<typename... Ts>
+        Value call(Ts&&... args) const
+        {
+            return executeFunction(true, std::forward<Ts>(args)...);
+        }
+
+        /// @note Strings read as const char* or views are valid only while table at the end of path references them
+        template<typename T>
+        T to() const
+        {
+            return read(static_cast<T*>(nullptr));
+        }
+
+        /// Set values to table at the end of path
+        ///
+        /// @note This function doesn't check if value is lua::Table. You must use is<lua::Table>() function if you want to be sure
+        template<typename K, typename T>
+        void set(K&& key, T&& value) const
+        {
+            push(getLuaState());
+            PopGuard guard{ getLuaState() };
+            traits::ValueTraits<K>::push(getLuaState(), std::forward<K>(key));
+            traits::ValueTraits<T>::push(getLuaState(), std::forward<T>(value));
+            lua_settable(getLuaState(), -3);
+        }
+
+        template<typename K>
+        void setData(K&& key, lua::String value, size_t length) const
+        {
+            push(getLuaState());
+            PopGuard guard{ getLuaState() };
+            traits::ValueTraits<K>::push(getLuaState(), std::forward<K>(key));
+            traits::ValueTraits<lua::String>::push(getLuaState(), value, length);
+            lua_settable(getLuaState(), -3);
+        }
+
+        template<typename K>
+        void setString(K&& key, const std::string& string) const
+        {
+            setData(std::forward<K>(key), string.c_str(), string.length());
+        }
+
+        /// Set many values to table at the end of path at once, see lua::Value::setMany
+        template<typename... Ts>
+        void setMany(Ts&&... keysAndValues) const
+        {
+            static_assert(sizeof...(Ts) % 2 == 0, "Keys and values must be passed in pairs");
+            push(getLuaState());
+            PopGuard guard{ getLuaState() };
+            luaL_checkstack(getLuaState(), 2, nullptr);
+            detail::rawSetMany(getLuaState(), lua_gettop(getLuaState()), std::forward<Ts>(keysAndValues)...);
+        }
+
+        /// Append elements of range to table at the end of path, see lua::Value::setRange
+        template<typename Iterator>
+        void setRange(Iterator first, Iterator last) const
+        {
+            using IsPair = detail::IsPair<typename std::decay<decltype(*first)>::type>;
+            push(getLuaState());
+            PopGuard guard{ getLuaState() };
+            luaL_checkstack(getLuaState(), 2, nullptr);
+            detail::rawSetRange(getLuaState(), lua_gettop(getLuaState()), first, last, IsPair());
+        }
+
+        /// Check if value at the end of path is some type from LuaPrimitives.h file
+        template <typename T>
+        bool is() const
+        {
+            push(getLuaState());
+            PopGuard guard{ getLuaState() };
+            return traits::ValueTraits<T>::isCompatible(getLuaState(), -1);
+        }
+
+        /// First check if value is type T and if yes stores it to value
+        ///
+        /// @return true if value was given type and stored to value false if not
+        template <typename T>
+        bool get(T& value) const
+        {
+            push(getLuaState());
+            PopGuard guard{ getLuaState() };
+            if (!traits::ValueTraits<T>::isCompatible(getLuaState(), -1))
+                return false;
+
+            value = traits::ValueTraits<T>::read(getLuaState(), -1);
+            return true;
+        }
+
+        size_t length() const
+        {
+            push(getLuaState());
+            PopGuard guard{ getLuaState() };
+            return lua_rawlen(getLuaState(), -1);
+        }
+
+        /// Walks path and pushes found value to stack
+        ///
+        /// @note Path can start at value on stack of other thread of same Lua state, found value is moved to given thread
+        ///
+        /// @return Number of pushed values
+        int push(lua_State* luaState) const
+        {
+            lua_State* pathState = getLuaState();
+            lua_pushvalue(pathState, m_root.m_stack->top + m_root.m_stack->pushed - m_root.m_stack->grouped);
+            walk(typename traits::MakeIndexTuple<Keys...>::Type());
+            if (pathState != luaState)
+                lua_xmove(pathState, luaState, 1);
+            return 1;
+        }
+    };
+
+    namespace traits {
+        template<typename... Keys>
+        struct ValueTraits<lua::Path<Keys...>>
+        {
+            static inline int push(lua_State* luaState, const lua::Path<Keys...>& path) {
+                return path.push(luaState);
+            }
+        };
+    }
+}
@@ -12,10 +12,34 @@
 
 #include <type_traits>
 
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define LUASTATE_CXX17
+#endif
+
+#if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+#define LUASTATE_CXX20
+#endif
+
 namespace lua
 {
-    /// Lua table type
-    struct Table {};
+    /// Lua table type. When table is pushed, space for given number of elements is preallocated, so filling it
+    /// doesn't need rehashing
+    struct Table
+    {
+        /// Number of preallocated array elements
+        int arraySize = 0;
+        
+        /// Number of preallocated non-array elements
+        int hashSize = 0;
+        
+        Table() = default;
+        
+        explicit Table(int arraySize, int hashSize = 0)
+            : arraySize(arraySize)
+            , hashSize(hashSize)
+        {
+        }
+    };
     
     /// Any Lua function, C function, or table/userdata with __call metamethod
     struct Callable {};
@@ -33,4 +57,17 @@ namespace lua
     using Nil = std::nullptr_t;
     
     using Pointer = void*;
+    
+    namespace detail {
+        
+        /// Same alignment which Lua guarantees for userdata memory
+        union MaxAlign
+        {
+            lua_Number number;
+            double real;
+            void* pointer;
+            lua_Integer integer;
+            long longInteger;
+        };
+    }
 }
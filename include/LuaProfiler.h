@@ -0,0 +1,424 @@
+//
+//  LuaProfiler.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaBudget.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace lua {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Sampling profiler of Lua state. Count hook takes sample of Lua stack after given number of instructions and time
+    /// since previous sample is added to function on top of the stack. Bound C++ functions are timed when they return,
+    /// because hook isn't called while they run. Short calls are only summed and added under function sampled next, so
+    /// cheap functions called in loops don't walk Lua stack on each call. Samples are aggregated into call tree, so
+    /// memory doesn't grow with duration of profiling, only with number of distinct stacks.
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// state.startProfiler(10000);
+    /// state["update"]();
+    /// state.stopProfiler();
+    ///
+    /// std::ofstream output("lua.folded");
+    /// state.getProfiler()->writeFolded(output);
+    /// ~~~~~~~~~~~~~~~
+    ///
+    /// @note Profiler shares count hook with lua::ExecutionBudget, other hooks of Lua state can't be used while it runs.
+    /// Coroutines get hook when they are resumed, but those created with coroutine.wrap before first profiler or
+    /// budget of state was started aren't sampled. Profiler must be stopped or destroyed before Lua state is closed.
+    class Profiler final : private detail::Sampler
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        /// Node of call tree, children are linked list of siblings
+        struct Node
+        {
+            /// Identity of function: interned chunk source and first line of Lua function, userdata of bound C++ function
+            /// or address of other C function
+            const void* function = nullptr;
+            int line = 0;
+
+            std::string name;
+            std::chrono::nanoseconds self{ 0 };
+
+            std::size_t firstChild = 0;
+            std::size_t nextSibling = 0;
+        };
+
+        struct Frame
+        {
+            const void* function;
+            int line;
+        };
+
+        /// Time of short calls of bound function which isn't added to call tree yet
+        struct PendingCall
+        {
+            const void* function;
+            std::string name;
+            std::chrono::nanoseconds time;
+        };
+
+        /// Calls shorter than this don't walk Lua stack
+        static std::chrono::nanoseconds getExactCallTime()
+        {
+            return std::chrono::microseconds(10);
+        }
+
+        /// Node 0 is root of call tree, so zero index means no child or sibling
+        std::deque<Node> m_nodes;
+
+        /// Stack of last sample, kept to avoid allocations in hook
+        std::vector<Frame> m_frames;
+
+        /// Short calls since last sample and their total time
+        std::vector<PendingCall> m_pendingCalls;
+        std::chrono::nanoseconds m_pendingTime{ 0 };
+
+        /// Copies of chunk sources identifying Lua functions. Lua interns only short strings, so source pointer of the same
+        /// chunk loaded again differs and pointer of freed chunk can be reused by other one.
+        std::unordered_set<std::string> m_sources;
+
+        /// Buffer for source lookups, kept to avoid allocations in hook
+        std::string m_source;
+
+        /// Node of last sample, pending calls left after outermost call are added under it
+        std::size_t m_lastNode = 0;
+
+        Clock::time_point m_lastEvent;
+        std::uint64_t m_sampleCount = 0;
+
+        lua_State* m_luaState = nullptr;
+
+        /// @return Identity of function on given stack level. Bound C++ function is identified by userdata in its first
+        /// upvalue, same as in lua::detail::NativeCall. Two free stack slots are needed.
+        Frame getFrame(lua_State* luaState, lua_Debug& debug)
+        {
+            lua_getinfo(luaState, "Sf", &debug);
+            if (debug.what[0] != 'C')
+            {
+                lua_pop(luaState, 1);
+                m_source.assign(debug.source);
+                auto source = m_sources.find(m_source);
+                if (source == m_sources.end())
+                    source = m_sources.insert(m_source).first;
+                return Frame{ source->c_str(), debug.linedefined };
+            }
+
+            Frame frame{ lua_topointer(luaState, -1), 0 };
+            if (lua_getupvalue(luaState, -1, 1) != nullptr)
+            {
+                if (lua_isuserdata(luaState, -1))
+                    frame.function = lua_touserdata(luaState, -1);
+                lua_pop(luaState, 1);
+            }
+            lua_pop(luaState, 1);
+            return frame;
+        }
+
+        /// @return Name of function in folded format, semicolons separate frames so they are replaced
+        static std::string getName(lua_State* luaState, lua_Debug& debug)
+        {
+            lua_getinfo(luaState, "Sn", &debug);
+
+            std::string name = debug.name != nullptr ? debug.name : (debug.what[0] == 'm' ? "main" : "anonymous");
+            if (debug.what[0] == 'C')
+                name += " [C]";
+            else
+                name += " (" + std::string(debug.short_src) + ":" + std::to_string(debug.linedefined) + ")";
+
+            for (char& character : name)
+            {
+                if (character == ';' || character == '\n')
+                    character = '_';
+            }
+            return name;
+        }
+
+        /// @return Link to child node of function called from given parent node, it is zero when there is no such child
+        std::size_t* findChild(std::size_t parent, const Frame& frame)
+        {
+            std::size_t* link = &m_nodes[parent].firstChild;
+            while (*link != 0)
+            {
+                const Node& node = m_nodes[*link];
+                if (node.function == frame.function && node.line == frame.line)
+                    break;
+                link = &m_nodes[*link].nextSibling;
+            }
+            return link;
+        }
+
+        /// Creates node of function and stores its index to link
+        std::size_t addChild(std::size_t* link, const Frame& frame, std::string name)
+        {
+            Node node;
+            node.function = frame.function;
+            node.line = frame.line;
+            node.name = std::move(name);
+            m_nodes.push_back(std::move(node));
+
+            *link = m_nodes.size() - 1;
+            return *link;
+        }
+
+        /// @return Node of function on stack level called from given parent node
+        std::size_t getChild(lua_State* luaState, std::size_t parent, const Frame& frame, int level)
+        {
+            std::size_t* link = findChild(parent, frame);
+            if (*link != 0)
+                return *link;
+
+            lua_Debug debug;
+            lua_getstack(luaState, level, &debug);
+            return addChild(link, frame, getName(luaState, debug));
+        }
+
+        /// @return Node of current Lua stack, first frames are skipped
+        std::size_t getStackNode(lua_State* luaState, int skipFrames)
+        {
+            m_frames.clear();
+            lua_Debug debug;
+            for (int level = skipFrames; lua_getstack(luaState, level, &debug); ++level)
+                m_frames.push_back(getFrame(luaState, debug));
+
+            std::size_t node = 0;
+            for (std::size_t index = m_frames.size(); index > 0; --index)
+                node = getChild(luaState, node, m_frames[index - 1], skipFrames + static_cast<int>(index) - 1);
+            return node;
+        }
+
+        /// Adds time of pending calls under given node, they were most likely made by its function
+        void addPendingCalls(std::size_t parent)
+        {
+            for (PendingCall& call : m_pendingCalls)
+            {
+                if (call.time.count() == 0)
+                    continue;
+
+                Frame frame{ call.function, 0 };
+                std::size_t* link = findChild(parent, frame);
+                std::size_t node = *link != 0 ? *link : addChild(link, frame, call.name);
+                m_nodes[node].self += call.time;
+                call.time = std::chrono::nanoseconds(0);
+            }
+            m_pendingTime = std::chrono::nanoseconds(0);
+        }
+
+        /// Forgets pending calls, their time stays in time since last event
+        void dropPendingCalls()
+        {
+            for (PendingCall& call : m_pendingCalls)
+                call.time = std::chrono::nanoseconds(0);
+            m_pendingTime = std::chrono::nanoseconds(0);
+        }
+
+        /// Adds pending calls under node of last sample, they were made at end of outermost call
+        void flushPendingCalls()
+        {
+            try {
+                addPendingCalls(m_lastNode);
+            } catch (...) {
+                dropPendingCalls();
+            }
+        }
+
+        /// Adds time since last event without time of pending calls to given node
+        void addElapsed(std::size_t node, Clock::time_point now)
+        {
+            if (now - m_lastEvent > m_pendingTime)
+                m_nodes[node].self += now - m_lastEvent - m_pendingTime;
+            addPendingCalls(node);
+        }
+
+        /// Sums time of short call to pending calls of bound function on level 0 of Lua stack
+        void addPendingCall(lua_State* luaState, const void* function, std::chrono::nanoseconds time)
+        {
+            auto call = std::find_if(m_pendingCalls.begin(), m_pendingCalls.end(),
+                [function](const PendingCall& pending) { return pending.function == function; });
+            if (call == m_pendingCalls.end())
+            {
+                lua_Debug debug;
+                lua_getstack(luaState, 0, &debug);
+                m_pendingCalls.push_back(PendingCall{ function, getName(luaState, debug), std::chrono::nanoseconds(0) });
+                call = m_pendingCalls.end() - 1;
+            }
+            call->time += time;
+            m_pendingTime += time;
+        }
+
+        void sample(lua_State* luaState) override
+        {
+            Clock::time_point now = Clock::now();
+            try {
+                m_lastNode = getStackNode(luaState, 0);
+                addElapsed(m_lastNode, now);
+                ++m_sampleCount;
+            } catch (...) {
+                // Sample is dropped when memory for new node can't be allocated, exception must not pass through Lua
+                dropPendingCalls();
+            }
+            m_lastEvent = now;
+        }
+
+        void nativeCall(lua_State* luaState, const void* function, Clock::time_point start) override
+        {
+            Clock::time_point now = Clock::now();
+            try {
+                if (function != nullptr && now - start < getExactCallTime())
+                {
+                    addPendingCall(luaState, function, now - start);
+                    return;
+                }
+
+                // Function could use all stack slots for its results, frames need two more
+                if (lua_checkstack(luaState, 2))
+                {
+                    // Time before call belongs to caller, it is known only now
+                    std::size_t caller = getStackNode(luaState, 1);
+                    addElapsed(caller, std::max(start, m_lastEvent));
+
+                    lua_Debug debug;
+                    lua_getstack(luaState, 0, &debug);
+                    std::size_t native = getChild(luaState, caller, getFrame(luaState, debug), 0);
+                    m_nodes[native].self += now - std::max(start, m_lastEvent);
+                    m_lastNode = caller;
+                    ++m_sampleCount;
+                }
+            } catch (...) {
+            }
+            dropPendingCalls();
+            m_lastEvent = now;
+        }
+
+        void callStarted() override
+        {
+            flushPendingCalls();
+            m_lastEvent = Clock::now();
+        }
+
+    public:
+
+        Profiler()
+        {
+            m_nodes.emplace_back();
+        }
+
+        ~Profiler()
+        {
+            if (m_luaState != nullptr)
+                stop();
+        }
+
+        // Count hook keeps pointer to profiler
+        Profiler(const Profiler&) = delete;
+        Profiler& operator=(const Profiler&) = delete;
+
+        /// Installs count hook which takes samples. Samples are added to already collected ones.
+        ///
+        /// @param luaState             Main thread of Lua state
+        /// @param sampleInterval       Number of Lua instructions between two samples
+        void start(lua_State* luaState, int sampleInterval)
+        {
+            assert(sampleInterval > 0);
+            if (m_luaState != nullptr)
+                stop();
+
+            detail::HookState& state = detail::getHookState(luaState);
+            state.sampler = this;
+            state.sampleInterval = sampleInterval;
+            state.untilSample = sampleInterval;
+
+            m_luaState = luaState;
+            m_lastEvent = Clock::now();
+            detail::scheduleHook(luaState, state);
+        }
+
+        /// Removes profiler from count hook, collected samples are kept
+        void stop()
+        {
+            if (m_luaState == nullptr)
+                return;
+
+            flushPendingCalls();
+
+            detail::HookState& state = detail::getHookState(m_luaState);
+            if (state.sampler == this)
+            {
+                state.sampler = nullptr;
+                detail::scheduleHook(m_luaState, state);
+            }
+            m_luaState = nullptr;
+        }
+
+        /// @return True when profiler takes samples
+        bool isRunning() const
+        {
+            return m_luaState != nullptr;
+        }
+
+        /// @return Number of samples and C++ calls which were long enough to be timed with their stack
+        std::uint64_t getSampleCount() const
+        {
+            return m_sampleCount;
+        }
+
+        /// Removes collected samples
+        void clear()
+        {
+            m_nodes.clear();
+            m_nodes.emplace_back();
+            m_sources.clear();
+            m_pendingCalls.clear();
+            m_pendingTime = std::chrono::nanoseconds(0);
+            m_lastNode = 0;
+            m_sampleCount = 0;
+        }
+
+        /// Writes call tree in folded stacks format used by flamegraph tools. Each line contains functions from
+        /// outermost to innermost separated by semicolons and time spent in innermost function in microseconds.
+        ///
+        /// ~~~~~~~~~~~~~~~
+        /// main (script.lua:0);update (script.lua:12);distance [C] 1520
+        /// ~~~~~~~~~~~~~~~
+        void writeFolded(std::ostream& output) const
+        {
+            std::string path;
+            writeFolded(output, m_nodes.front().firstChild, path);
+        }
+
+    private:
+
+        void writeFolded(std::ostream& output, std::size_t index, std::string& path) const
+        {
+            for (; index != 0; index = m_nodes[index].nextSibling)
+            {
+                const Node& node = m_nodes[index];
+                std::size_t length = path.size();
+                if (length > 0)
+                    path += ';';
+                path += node.name;
+
+                auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(node.self).count();
+                if (microseconds > 0)
+                    output << path << ' ' << microseconds << '\n';
+
+                writeFolded(output, node.firstChild, path);
+                path.resize(length);
+            }
+        }
+    };
+}
@@ -20,38 +20,52 @@ namespace lua {
         
         
         //////////////////////////////////////////////////////////////////////////////////////////////
-        /// Function get single value from lua stack
+        /// Function get single value from lua stack. Value is read directly from stack, only lua::Value needs stack item
+        /// which will own its stack slot
         template<typename T>
         inline T readValue(::lua_State* luaState,
-                           detail::DeallocQueue* deallocQueue,
-                           int stackTop)
+                           detail::DeallocQueue*,
+                           detail::StackItemPool*,
+                           int index)
         {
             static_assert(std::is_same<traits::RemoveCVR<T>, T>::value, "T must not be CV-qualified or a reference");
-            return lua::Value(std::make_shared<detail::StackItem>(luaState, deallocQueue, stackTop - 1, 1, 0)).to<T>();
+            return traits::ValueTraits<T>::read(luaState, index);
+        }
+        
+        template<>
+        inline lua::Value readValue<lua::Value>(::lua_State* luaState,
+                                                detail::DeallocQueue* deallocQueue,
+                                                detail::StackItemPool* pool,
+                                                int index)
+        {
+            return lua::Value(detail::makeStackItem(pool, luaState, deallocQueue, index - 1, 1, 0));
         }
 
         /// Function creates indexes for mutli values and get them from stack
         template<typename... Ts, std::size_t... Is>
         inline std::tuple<Ts...> unpackMultiValues(::lua_State* luaState,
                                                                       detail::DeallocQueue* deallocQueue,
+                                                                      detail::StackItemPool* pool,
                                                                       int stackTop,
                                                                       traits::Indices<Is...>)
         {
-            return std::make_tuple(readValue<Ts>(luaState, deallocQueue, Is + stackTop)...);
+            return std::tuple<Ts...>(readValue<Ts>(luaState, deallocQueue, pool, Is + stackTop)...);
         }
 
         /// Function expects that number of elements in tuple and number of pushed values in stack are same. Applications takes care of this requirement by popping overlapping values before calling this function
         template<typename... Ts>
         inline std::tuple<Ts...> get_and_pop(::lua_State* luaState,
                                                                 detail::DeallocQueue* deallocQueue,
+                                                                detail::StackItemPool* pool,
                                                                 int stackTop)
         {
-            return unpackMultiValues<Ts...>(luaState, deallocQueue, stackTop, typename traits::MakeIndices<sizeof...(Ts)>::Type());
+            return unpackMultiValues<Ts...>(luaState, deallocQueue, pool, stackTop, typename traits::MakeIndices<sizeof...(Ts)>::Type());
         }
 
         template<>
         inline std::tuple<> get_and_pop<>(::lua_State*,
                                           detail::DeallocQueue*,
+                                          detail::StackItemPool*,
                                           int)
         {
             return {};
@@ -82,26 +96,37 @@ namespace lua {
         /// @param function     Function being called
         void operator=(const Value& value)
         {
-            
+            lua_State* luaState = value.m_stack->state;
+            detail::DeallocQueue* deallocQueue = value.m_stack->deallocQueue;
+            int top = value.m_stack->top;
             int requiredValues = std::min<int>(sizeof...(Ts), value.m_stack->pushed);
             
             // When there are more returned values than variables in tuple, we will clear values that are not needed
-            if (requiredValues < value.m_stack->grouped + 1)
+            if (requiredValues < value.m_stack->pushed)
             {
-                
-                int currentStackTop = lua_gettop(value.m_stack->state);
-                
                 // We will check if we haven't pushed some other new lua::Value to stack
-                if (value.m_stack->top + value.m_stack->pushed == currentStackTop)
-                    lua_settop(value.m_stack->state, value.m_stack->top + requiredValues);
+                if (top + value.m_stack->pushed == lua_gettop(luaState))
+                    lua_settop(luaState, top + requiredValues);
                 else
-                    value.m_stack->deallocQueue->push(detail::DeallocStackItem(value.m_stack->top, value.m_stack->pushed));
+                    deallocQueue->push(detail::DeallocStackItem(top + requiredValues, value.m_stack->pushed - requiredValues));
             }
             
             // We will take pushed values and distribute them to returned lua::Values
             value.m_stack->pushed = 0;
             
-            m_tiedValues = stack::get_and_pop<traits::RemoveCVR<Ts>...>(value.m_stack->state, value.m_stack->deallocQueue, value.m_stack->top + 1);
+            m_tiedValues = stack::get_and_pop<traits::RemoveCVR<Ts>...>(luaState, deallocQueue, value.m_stack->pool, top + 1);
+            
+            // Values which were read to other types than lua::Value are not owned by anyone, so we release them now
+            static const bool isValue[] = { std::is_same<traits::RemoveCVR<Ts>, lua::Value>::value..., true };
+            for (int i = 0; i < requiredValues; ++i)
+            {
+                if (!isValue[i])
+                    deallocQueue->push(detail::DeallocStackItem(top + i, 1));
+            }
+            
+            int currentStackTop = lua_gettop(luaState);
+            if (top + requiredValues == currentStackTop)
+                lua_settop(luaState, deallocQueue->reclaim(currentStackTop));
         }
         
     };
@@ -0,0 +1,470 @@
+//
+//  LuaSerializer.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaState.h"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace lua {
+
+    namespace detail {
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Binary codec of Lua values. Each value starts with tag byte, integers and lengths are stored as variable length
+        /// integers, numbers as 8 bytes in little endian order. Tables store sizes of their array and hash parts first, so
+        /// they can be created presized. Tables and strings get ids in order in which they are first encoded, and their
+        /// next occurrences are encoded as references to these ids, so shared and cyclic tables keep their identity.
+        namespace serializer {
+
+            enum Tag : unsigned char
+            {
+                TagNil = 0,
+                TagFalse,
+                TagTrue,
+                TagInteger,
+                TagNumber,
+                TagString,
+                TagTable,
+                TagReference,
+            };
+
+            /// Maximum nesting of tables, it protects C stack
+            const int MaxDepth = 200;
+
+            inline void writeVarint(std::string& buffer, std::uint64_t value)
+            {
+                while (value >= 0x80)
+                {
+                    buffer.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                    value >>= 7;
+                }
+                buffer.push_back(static_cast<char>(value));
+            }
+
+            inline std::uint64_t readVarint(const char*& data, const char* end)
+            {
+                std::uint64_t value = 0;
+                for (int shift = 0; shift < 64; shift += 7)
+                {
+                    if (data == end)
+                        throw SerializationError("Truncated data");
+
+                    unsigned char byte = static_cast<unsigned char>(*data++);
+                    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                    if ((byte & 0x80) == 0)
+                        return value;
+                }
+                throw SerializationError("Malformed integer");
+            }
+
+            /// @return Size read from data, it is checked against remaining bytes, because every element takes at least one byte
+            inline int readSize(const char*& data, const char* end)
+            {
+                std::uint64_t size = readVarint(data, end);
+                if (size > static_cast<std::uint64_t>(end - data) || size > static_cast<std::uint64_t>(std::numeric_limits<int>::max()))
+                    throw SerializationError("Invalid size");
+                return static_cast<int>(size);
+            }
+
+            /// @return True when key at given index is stored in array part of encoded table
+            inline bool isArrayKey(lua_State* luaState, int index, lua_Integer arraySize)
+            {
+#if LUA_VERSION_NUM >= 503
+                if (!lua_isinteger(luaState, index))
+                    return false;
+#else
+                if (lua_type(luaState, index) != LUA_TNUMBER || lua_tonumber(luaState, index) != static_cast<lua_Number>(lua_tointeger(luaState, index)))
+                    return false;
+#endif
+                lua_Integer key = lua_tointeger(luaState, index);
+                return key >= 1 && key <= arraySize;
+            }
+
+            //////////////////////////////////////////////////////////////////////////////////////////////
+            /// Encodes values to buffer. Ids of encoded tables and strings are kept in table on stack, which is removed
+            /// together with everything pushed by encoder when encoder is destroyed.
+            class Encoder
+            {
+                lua_State* m_luaState;
+                std::string& m_buffer;
+                int m_stackTop;
+
+                /// Index of table, which maps encoded tables and strings to their ids
+                int m_ids;
+                lua_Integer m_nextId = 1;
+
+                /// Writes reference when value was already encoded, otherwise assigns new id to it
+                ///
+                /// @return True when reference was written
+                bool writeReference(int index)
+                {
+                    lua_pushvalue(m_luaState, index);
+                    lua_rawget(m_luaState, m_ids);
+                    if (!lua_isnil(m_luaState, -1))
+                    {
+                        m_buffer.push_back(TagReference);
+                        writeVarint(m_buffer, static_cast<std::uint64_t>(lua_tointeger(m_luaState, -1)));
+                        lua_pop(m_luaState, 1);
+                        return true;
+                    }
+                    lua_pop(m_luaState, 1);
+
+                    lua_pushvalue(m_luaState, index);
+                    lua_pushinteger(m_luaState, m_nextId++);
+                    lua_rawset(m_luaState, m_ids);
+                    return false;
+                }
+
+            public:
+
+                Encoder(lua_State* luaState, std::string& buffer)
+                    : m_luaState(luaState)
+                    , m_buffer(buffer)
+                    , m_stackTop(lua_gettop(luaState))
+                {
+                    lua_newtable(m_luaState);
+                    m_ids = lua_gettop(m_luaState);
+                }
+
+                ~Encoder()
+                {
+                    lua_settop(m_luaState, m_stackTop);
+                }
+
+                Encoder(const Encoder&) = delete;
+                Encoder& operator=(const Encoder&) = delete;
+
+                /// Appends value at given stack index to buffer
+                ///
+                /// @throws lua::SerializationError When value contains functions, userdata, threads or is nested too deep
+                void encode(int index, int depth = 0)
+                {
+                    index = lua_absindex(m_luaState, index);
+
+                    switch (lua_type(m_luaState, index))
+                    {
+                        case LUA_TNIL:
+                            m_buffer.push_back(TagNil);
+                            break;
+
+                        case LUA_TBOOLEAN:
+                            m_buffer.push_back(lua_toboolean(m_luaState, index) ? TagTrue : TagFalse);
+                            break;
+
+                        case LUA_TNUMBER:
+                        {
+#if LUA_VERSION_NUM >= 503
+                            if (lua_isinteger(m_luaState, index))
+                            {
+                                // Zig-zag encoding keeps small negative integers short
+                                std::uint64_t value = static_cast<std::uint64_t>(lua_tointeger(m_luaState, index));
+                                m_buffer.push_back(TagInteger);
+                                writeVarint(m_buffer, (value << 1) ^ (0 - (value >> 63)));
+                                break;
+                            }
+#endif
+                            double number = static_cast<double>(lua_tonumber(m_luaState, index));
+                            std::uint64_t bits;
+                            std::memcpy(&bits, &number, sizeof(bits));
+
+                            m_buffer.push_back(TagNumber);
+                            for (int byte = 0; byte < 8; ++byte)
+                                m_buffer.push_back(static_cast<char>(bits >> (8 * byte)));
+                            break;
+                        }
+
+                        case LUA_TSTRING:
+                        {
+                            if (writeReference(index))
+                                break;
+
+                            std::size_t length = 0;
+                            const char* string = lua_tolstring(m_luaState, index, &length);
+                            m_buffer.push_back(TagString);
+                            writeVarint(m_buffer, length);
+                            m_buffer.append(string, length);
+                            break;
+                        }
+
+                        case LUA_TTABLE:
+                        {
+                            if (depth >= MaxDepth)
+                                throw SerializationError("Table is nested too deep");
+                            luaL_checkstack(m_luaState, 4, nullptr);
+
+                            if (writeReference(index))
+                                break;
+
+                            // Elements after array part are counted first, so table can be presized when it is decoded
+                            lua_Integer arraySize = static_cast<lua_Integer>(lua_rawlen(m_luaState, index));
+                            std::uint64_t hashSize = 0;
+                            lua_pushnil(m_luaState);
+                            while (lua_next(m_luaState, index) != 0)
+                            {
+                                lua_pop(m_luaState, 1);
+                                if (!isArrayKey(m_luaState, -1, arraySize))
+                                    ++hashSize;
+                            }
+
+                            m_buffer.push_back(TagTable);
+                            writeVarint(m_buffer, static_cast<std::uint64_t>(arraySize));
+                            writeVarint(m_buffer, hashSize);
+
+                            for (lua_Integer i = 1; i <= arraySize; ++i)
+                            {
+                                lua_rawgeti(m_luaState, index, i);
+                                encode(-1, depth + 1);
+                                lua_pop(m_luaState, 1);
+                            }
+
+                            lua_pushnil(m_luaState);
+                            while (lua_next(m_luaState, index) != 0)
+                            {
+                                if (!isArrayKey(m_luaState, -2, arraySize))
+                                {
+                                    encode(-2, depth + 1);
+                                    encode(-1, depth + 1);
+                                }
+                                lua_pop(m_luaState, 1);
+                            }
+                            break;
+                        }
+
+                        default:
+                            throw SerializationError(std::string("Value of type ") + luaL_typename(m_luaState, index) + " can't be serialized");
+                    }
+                }
+            };
+
+            //////////////////////////////////////////////////////////////////////////////////////////////
+            /// Decodes values from buffer to stack. Decoded tables and strings are kept in table on stack, so references
+            /// can find them. When decoder is destroyed before finish, everything pushed by decoder is removed.
+            class Decoder
+            {
+                lua_State* m_luaState;
+                const char* m_data;
+                const char* m_end;
+                int m_stackTop;
+
+                /// Index of table with decoded tables and strings indexed by their ids
+                int m_objects;
+                lua_Integer m_count = 0;
+
+                void store()
+                {
+                    lua_pushvalue(m_luaState, -1);
+                    lua_rawseti(m_luaState, m_objects, ++m_count);
+                }
+
+            public:
+
+                Decoder(lua_State* luaState, const char* data, const char* end)
+                    : m_luaState(luaState)
+                    , m_data(data)
+                    , m_end(end)
+                    , m_stackTop(lua_gettop(luaState))
+                {
+                    lua_newtable(m_luaState);
+                    m_objects = lua_gettop(m_luaState);
+                }
+
+                ~Decoder()
+                {
+                    if (m_objects != 0)
+                        lua_settop(m_luaState, m_stackTop);
+                }
+
+                Decoder(const Decoder&) = delete;
+                Decoder& operator=(const Decoder&) = delete;
+
+                /// Removes table with decoded objects, decoded values stay in stack
+                ///
+                /// @return Position after last decoded value
+                const char* finish()
+                {
+                    lua_remove(m_luaState, m_objects);
+                    m_objects = 0;
+                    return m_data;
+                }
+
+                /// Pushes decoded value to stack
+                ///
+                /// @throws lua::SerializationError When data are malformed
+                void decode(int depth = 0)
+                {
+                    if (m_data == m_end)
+                        throw SerializationError("Truncated data");
+                    luaL_checkstack(m_luaState, 4, nullptr);
+
+                    switch (static_cast<unsigned char>(*m_data++))
+                    {
+                        case TagNil:
+                            lua_pushnil(m_luaState);
+                            break;
+
+                        case TagFalse:
+                            lua_pushboolean(m_luaState, 0);
+                            break;
+
+                        case TagTrue:
+                            lua_pushboolean(m_luaState, 1);
+                            break;
+
+                        case TagInteger:
+                        {
+                            std::uint64_t value = readVarint(m_data, m_end);
+                            lua_pushinteger(m_luaState, static_cast<lua_Integer>((value >> 1) ^ (0 - (value & 1))));
+                            break;
+                        }
+
+                        case TagNumber:
+                        {
+                            if (m_end - m_data < 8)
+                                throw SerializationError("Truncated data");
+
+                            std::uint64_t bits = 0;
+                            for (int byte = 0; byte < 8; ++byte)
+                                bits |= static_cast<std::uint64_t>(static_cast<unsigned char>(*m_data++)) << (8 * byte);
+
+                            double number;
+                            std::memcpy(&number, &bits, sizeof(number));
+                            lua_pushnumber(m_luaState, static_cast<lua_Number>(number));
+                            break;
+                        }
+
+                        case TagString:
+                        {
+                            // String is pushed directly from buffer without temporary copy
+                            int length = readSize(m_data, m_end);
+                            lua_pushlstring(m_luaState, m_data, static_cast<std::size_t>(length));
+                            m_data += length;
+                            store();
+                            break;
+                        }
+
+                        case TagReference:
+                        {
+                            std::uint64_t id = readVarint(m_data, m_end);
+                            if (id == 0 || id > static_cast<std::uint64_t>(m_count))
+                                throw SerializationError("Invalid reference");
+                            lua_rawgeti(m_luaState, m_objects, static_cast<lua_Integer>(id));
+                            break;
+                        }
+
+                        case TagTable:
+                        {
+                            if (depth >= MaxDepth)
+                                throw SerializationError("Table is nested too deep");
+
+                            int arraySize = readSize(m_data, m_end);
+                            int hashSize = readSize(m_data, m_end);
+                            lua_createtable(m_luaState, arraySize, hashSize);
+
+                            // Table is stored before its fields, so they can refer to it
+                            store();
+
+                            for (int i = 1; i <= arraySize; ++i)
+                            {
+                                decode(depth + 1);
+                                lua_rawseti(m_luaState, -2, i);
+                            }
+
+                            for (int i = 0; i < hashSize; ++i)
+                            {
+                                decode(depth + 1);
+                                if (lua_isnil(m_luaState, -1) || (lua_type(m_luaState, -1) == LUA_TNUMBER && lua_tonumber(m_luaState, -1) != lua_tonumber(m_luaState, -1)))
+                                    throw SerializationError("Table key is nil or NaN");
+                                decode(depth + 1);
+                                lua_rawset(m_luaState, -3);
+                            }
+                            break;
+                        }
+
+                        default:
+                            throw SerializationError("Unknown tag");
+                    }
+                }
+            };
+
+            /// Magic bytes and version at start of each record
+            const char Magic[4] = { 'L', 'S', 'V', 1 };
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Appends serialized value to output. Each record starts with magic bytes and length of payload, so many records
+    /// can be written to one stream and read one after another with lua::deserialize.
+    ///
+    /// Values can be nil, booleans, numbers, strings and tables of them. Shared and cyclic tables keep their identity and
+    /// repeated strings are stored only once. Metatables are not serialized.
+    ///
+    /// @throws lua::SerializationError When value contains functions, userdata or threads, or it is nested too deep
+    inline void serialize(const Value& value, std::string& output)
+    {
+        std::string payload;
+        {
+            detail::serializer::Encoder encoder(value.getLuaState(), payload);
+            encoder.encode(value.getStackIndex());
+        }
+
+        output.append(detail::serializer::Magic, sizeof(detail::serializer::Magic));
+        detail::serializer::writeVarint(output, payload.size());
+        output.append(payload);
+    }
+
+    /// Serializes value to new string
+    ///
+    /// @throws lua::SerializationError When value contains functions, userdata or threads, or it is nested too deep
+    inline std::string serialize(const Value& value)
+    {
+        std::string output;
+        serialize(value, output);
+        return output;
+    }
+
+    /// Creates value from serialized record
+    ///
+    /// @throws lua::SerializationError When data are not valid record
+    ///
+    /// @param state    State where value will be created
+    /// @param data     Serialized data, it can contain more records
+    /// @param length   Length of data in bytes
+    /// @param consumed If not nullptr, number of bytes of read record is stored to it, so next record can be read
+    inline Value deserialize(State& state, const char* data, std::size_t length, std::size_t* consumed = nullptr)
+    {
+        const char* end = data + length;
+        if (length < sizeof(detail::serializer::Magic) || std::memcmp(data, detail::serializer::Magic, sizeof(detail::serializer::Magic)) != 0)
+            throw SerializationError("Data don't start with serialized value");
+
+        const char* payload = data + sizeof(detail::serializer::Magic);
+        int payloadLength = detail::serializer::readSize(payload, end);
+
+        detail::serializer::Decoder decoder(state.getState(), payload, payload + payloadLength);
+        decoder.decode();
+        const char* position = decoder.finish();
+
+        Value value = state.adoptStackValues(1);
+        if (position != payload + payloadLength)
+            throw SerializationError("Unexpected data after serialized value");
+
+        if (consumed != nullptr)
+            *consumed = static_cast<std::size_t>(position - data);
+        return value;
+    }
+
+    /// Creates value from serialized record
+    ///
+    /// @throws lua::SerializationError When data are not valid record
+    inline Value deserialize(State& state, const std::string& data)
+    {
+        return deserialize(state, data.data(), data.size());
+    }
+}
@@ -8,15 +8,9 @@
 
 #pragma once
 
-#include <lua.hpp>
+#include "Traits.h"
 
 namespace lua {
-    namespace traits
-    {
-        template<typename T>
-        struct ValueTraits;
-    }
-
     namespace stack
     {
         template<typename T>
@@ -10,7 +10,11 @@
 
 #include <lua.hpp>
 
-#include <queue>
+#include <algorithm>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace lua { namespace detail {
         
@@ -25,15 +29,93 @@ namespace lua { namespace detail {
             , size(numElements)
         {
         }
-
-        bool operator<(const DeallocStackItem& rhs) const noexcept
+    };
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Stack ranges of destroyed lua::Value instances, which couldn't be popped yet because there are other values above
+    /// them. Ranges are stored in flat array indexed by stack index where they end, so both inserting range and popping
+    /// ranges adjacent to released top of stack are O(1) for each range.
+    class DeallocQueue
+    {
+        /// Size of range ending at given stack index, zero when there is no such range
+        std::vector<int> m_sizes;
+        
+        /// Number of stored ranges
+        std::size_t m_count = 0;
+        
+    public:
+        
+        DeallocQueue()
+        {
+            m_sizes.resize(LUA_MINSTACK, 0);
+        }
+        
+        /// Stores range which will be released together with values below it
+        void push(const DeallocStackItem& item)
+        {
+            // Empty range has nothing to release
+            if (item.size <= 0)
+                return;
+            
+            std::size_t end = static_cast<std::size_t>(item.end);
+            if (end >= m_sizes.size())
+                m_sizes.resize(std::max(end + 1, 2 * m_sizes.size()), 0);
+            
+            int& size = m_sizes[end];
+            if (size == 0)
+                ++m_count;
+            
+            // Ranges ending at same index overlap, so longer one covers both
+            size = std::max(size, item.size);
+        }
+        
+        /// Removes all stored ranges which are directly below given top of stack
+        ///
+        /// @param top  Top of stack after popping released values
+        ///
+        /// @return Top of stack after popping also stored ranges
+        int reclaim(int top)
         {
-            return end < rhs.end;
+            while (top > 0 && static_cast<std::size_t>(top) < m_sizes.size() && m_sizes[top] != 0)
+            {
+                int size = m_sizes[top];
+                m_sizes[top] = 0;
+                --m_count;
+                top -= size;
+            }
+            return top;
+        }
+        
+        bool empty() const
+        {
+            return m_count == 0;
+        }
+        
+        std::size_t size() const
+        {
+            return m_count;
+        }
+        
+        /// @return All stored ranges ordered by their end
+        std::vector<DeallocStackItem> items() const
+        {
+            std::vector<DeallocStackItem> result;
+            for (std::size_t end = 0; end < m_sizes.size(); ++end)
+            {
+                if (m_sizes[end] != 0)
+                    result.emplace_back(static_cast<int>(end) - m_sizes[end], m_sizes[end]);
+            }
+            return result;
+        }
+        
+        void clear()
+        {
+            std::fill(m_sizes.begin(), m_sizes.end(), 0);
+            m_count = 0;
         }
     };
     
-    //////////////////////////////////////////////////////////////////////////////////////////////
-    using DeallocQueue = std::priority_queue<DeallocStackItem>;
+    class StackItemPool;
     
     //////////////////////////////////////////////////////////////////////////////////////////////
     struct StackItem
@@ -42,6 +124,12 @@ namespace lua { namespace detail {
         lua_State* state = nullptr;
         detail::DeallocQueue* deallocQueue = nullptr;
         
+        /// Pool from which was this item created, nullptr when it was created with new
+        detail::StackItemPool* pool = nullptr;
+        
+        /// Number of StackItemPtr instances pointing to this item. Lua state is single threaded, so it is not atomic
+        int refCount = 1;
+        
         /// Indicates number of pushed values to stack on lua::Value when created
         int top;
         
@@ -53,9 +141,10 @@ namespace lua { namespace detail {
         
         StackItem() = default;
         
-        StackItem(lua_State* luaState, detail::DeallocQueue* deallocQueue, int stackTop, int pushedValues, int groupedValues)
+        StackItem(lua_State* luaState, detail::DeallocQueue* deallocQueue, detail::StackItemPool* pool, int stackTop, int pushedValues, int groupedValues)
             : state(luaState)
             , deallocQueue(deallocQueue)
+            , pool(pool)
             , top(stackTop)
             , pushed(pushedValues)
             , grouped(groupedValues)
@@ -79,20 +168,186 @@ namespace lua { namespace detail {
             if (top + pushed == currentStackTop)
             {
 
-                // We will check deallocation priority queue, if there are some lua::Value instances to be deleted
-                while (!deallocQueue->empty() && deallocQueue->top().end == top)
-                {
-                    top -= deallocQueue->top().size;
-                    deallocQueue->pop();
-                }
-                lua_settop(state, top);
+                // We will check deallocation queue, if there are some lua::Value instances to be deleted
+                lua_settop(state, deallocQueue->reclaim(top));
             }
             else
             {
                 // If yes we can't pop values, we must pop it after deletion of newly created lua::Value
-                // We will put this deallocation to our priority queue, so it will be deleted as soon as possible
+                // We will put this deallocation to our queue, so it will be deleted as soon as possible
                 deallocQueue->push(detail::DeallocStackItem(top, pushed));
             }
         }
     };
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Storage of StackItem instances for one Lua state. Items are constructed in slabs and destroyed items are kept in
+    /// free list, so after few first lua::Value instances we don't allocate any memory.
+    class StackItemPool
+    {
+        union Slot
+        {
+            Slot* next;
+            typename std::aligned_storage<sizeof(StackItem), alignof(StackItem)>::type storage;
+        };
+        
+        struct Slab
+        {
+            static const int Size = 64;
+            
+            Slab* next;
+            Slot slots[Size];
+        };
+        
+        Slab* m_slabs = nullptr;
+        Slot* m_freeSlots = nullptr;
+        
+    public:
+        
+        StackItemPool() = default;
+        
+        ~StackItemPool()
+        {
+            while (m_slabs != nullptr)
+            {
+                Slab* next = m_slabs->next;
+                delete m_slabs;
+                m_slabs = next;
+            }
+        }
+        
+        // Pool is non-copyable
+        StackItemPool(const StackItemPool&) = delete;
+        StackItemPool& operator=(const StackItemPool&) = delete;
+        
+        void* allocate()
+        {
+            if (m_freeSlots == nullptr)
+            {
+                Slab* slab = new Slab();
+                slab->next = m_slabs;
+                m_slabs = slab;
+                
+                for (Slot& slot : slab->slots)
+                {
+                    slot.next = m_freeSlots;
+                    m_freeSlots = &slot;
+                }
+            }
+            
+            Slot* slot = m_freeSlots;
+            m_freeSlots = slot->next;
+            return slot;
+        }
+        
+        void deallocate(void* memory) noexcept
+        {
+            Slot* slot = static_cast<Slot*>(memory);
+            slot->next = m_freeSlots;
+            m_freeSlots = slot;
+        }
+    };
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Intrusive reference counted pointer to StackItem. Last reference destroys item, which releases its values from stack.
+    class StackItemPtr
+    {
+        StackItem* m_item = nullptr;
+        
+        void release() noexcept
+        {
+            if (m_item == nullptr || --m_item->refCount > 0)
+                return;
+            
+            StackItemPool* pool = m_item->pool;
+            if (pool == nullptr)
+            {
+                delete m_item;
+            }
+            else
+            {
+                m_item->~StackItem();
+                pool->deallocate(m_item);
+            }
+        }
+        
+    public:
+        
+        StackItemPtr() = default;
+        
+        StackItemPtr(std::nullptr_t)
+        {
+        }
+        
+        /// Takes ownership of newly created item, which has reference count set to one
+        explicit StackItemPtr(StackItem* item)
+            : m_item(item)
+        {
+        }
+        
+        StackItemPtr(const StackItemPtr& other) noexcept
+            : m_item(other.m_item)
+        {
+            if (m_item != nullptr)
+                ++m_item->refCount;
+        }
+        
+        StackItemPtr(StackItemPtr&& other) noexcept
+            : m_item(other.m_item)
+        {
+            other.m_item = nullptr;
+        }
+        
+        ~StackItemPtr()
+        {
+            release();
+        }
+        
+        StackItemPtr& operator=(const StackItemPtr& other) noexcept
+        {
+            StackItemPtr(other).swap(*this);
+            return *this;
+        }
+        
+        StackItemPtr& operator=(StackItemPtr&& other) noexcept
+        {
+            StackItemPtr(std::move(other)).swap(*this);
+            return *this;
+        }
+        
+        void swap(StackItemPtr& other) noexcept
+        {
+            std::swap(m_item, other.m_item);
+        }
+        
+        StackItem* get() const noexcept
+        {
+            return m_item;
+        }
+        
+        StackItem* operator->() const noexcept
+        {
+            return m_item;
+        }
+        
+        StackItem& operator*() const noexcept
+        {
+            return *m_item;
+        }
+        
+        explicit operator bool() const noexcept
+        {
+            return m_item != nullptr;
+        }
+    };
+    
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Creates StackItem in given pool, or on heap when pool is nullptr
+    inline StackItemPtr makeStackItem(StackItemPool* pool, lua_State* luaState, DeallocQueue* deallocQueue, int stackTop, int pushedValues, int groupedValues)
+    {
+        if (pool == nullptr)
+            return StackItemPtr(new StackItem(luaState, deallocQueue, nullptr, stackTop, pushedValues, groupedValues));
+        
+        return StackItemPtr(new (pool->allocate()) StackItem(luaState, deallocQueue, pool, stackTop, pushedValues, groupedValues));
+    }
 } }
@@ -11,14 +11,26 @@
 #pragma once
 
 #include "Traits.h"
+#include "ContainerTraits.h"
+#include "StructTraits.h"
 
+#include "LuaAllocator.h"
+#include "LuaBudget.h"
+#include "LuaProfiler.h"
+#include "LuaChunkCache.h"
 #include "LuaPrimitives.h"
 #include "LuaException.h"
 #include "LuaStackItem.h"
 #include "LuaValue.h"
+#include "LuaChunk.h"
+#include "LuaKey.h"
+#include "LuaPath.h"
+#include "ValueReference.h"
 #include "LuaFunctor.h"
+#include "LuaClass.h"
 #include "Any.h"
 
+#include <cstring>
 #include <memory>
 
 namespace lua {
@@ -27,61 +39,107 @@ namespace lua {
     /// Class that hold lua interpreter state. Lua state is managed by pointer which also is copied to lua::Ref values.
     class State
     {
+        /// Allocator which counts and limits memory of Lua state. It is released after Lua state is closed
+        std::unique_ptr<AccountingAllocator> m_allocator = nullptr;
+        
         /// Class takes care of automaticaly closing Lua state when in destructor
         lua_State* m_luaState = nullptr;
         
         /// Class deletes DeallocQueue in destructor
         std::unique_ptr<detail::DeallocQueue> m_deallocQueue = nullptr;
         
-        /// Function for metatable "__call" field. It calls stored functor pushes return values to stack.
-        ///
-        /// @pre In Lua C API during function calls lua_State moves stack index to place, where first element is our userdata, and next elements are returned values
-        static int metatableCallFunction(lua_State* luaState)
+        /// Storage of stack items for lua::Value instances created from this state
+        std::unique_ptr<detail::StackItemPool> m_stackItemPool = nullptr;
+        
+        /// Cache of compiled files used by doFile, nullptr when caching is disabled
+        std::unique_ptr<ChunkCache> m_chunkCache = nullptr;
+        
+        /// Profiler created by first startProfiler, nullptr when it was never started
+        std::unique_ptr<Profiler> m_profiler = nullptr;
+        
+        /// Function for unprotected errors. Same as in luaL_newstate, which we don't use because of our allocator
+        static int panicFunction(lua_State* luaState)
         {
-            BaseFunctor* functor = *(BaseFunctor **)luaL_checkudata(luaState, 1, "luaL_Functor");;
-            return functor->call(luaState);
+            std::cerr << "PANIC: unprotected error in call to Lua API (";
+            if (lua_type(luaState, -1) == LUA_TSTRING || lua_type(luaState, -1) == LUA_TNUMBER)
+                std::cerr << lua_tostring(luaState, -1);
+            else
+                std::cerr << "error object is a " << luaL_typename(luaState, -1) << " value";
+            std::cerr << ")" << std::endl;
+            return 0;
         }
         
-        /// Function for metatable "__gc" field. It deletes captured variables from stored functors.
-        static int metatableDeleteFunction(lua_State* luaState)
+#if LUA_VERSION_NUM >= 504
+        /// Warning functions for Lua function warn. Same as in luaL_newstate, warnings are off until "@on" is emitted.
+        static bool warningControl(lua_State* luaState, const char* message, int toContinue)
         {
-            BaseFunctor* functor = *(BaseFunctor **)luaL_checkudata(luaState, 1, "luaL_Functor");;
-            delete functor;
-            return 0;
+            if (toContinue || *message != '@')
+                return false;
+            
+            if (std::strcmp(message + 1, "off") == 0)
+                lua_setwarnf(luaState, &State::warningOff, luaState);
+            else if (std::strcmp(message + 1, "on") == 0)
+                lua_setwarnf(luaState, &State::warningOn, luaState);
+            return true;
         }
         
+        static void warningOff(void* userData, const char* message, int toContinue)
+        {
+            warningControl(static_cast<lua_State*>(userData), message, toContinue);
+        }
+        
+        static void warningContinue(void* userData, const char* message, int toContinue)
+        {
+            lua_State* luaState = static_cast<lua_State*>(userData);
+            std::cerr << message;
+            if (toContinue)
+            {
+                lua_setwarnf(luaState, &State::warningContinue, luaState);
+            }
+            else
+            {
+                std::cerr << std::endl;
+                lua_setwarnf(luaState, &State::warningOn, luaState);
+            }
+        }
+        
+        static void warningOn(void* userData, const char* message, int toContinue)
+        {
+            if (warningControl(static_cast<lua_State*>(userData), message, toContinue))
+                return;
+            
+            std::cerr << "Lua warning: ";
+            warningContinue(userData, message, toContinue);
+        }
+#endif
+        
         lua::Value executeLoadedFunction(int index) const
         {
-            if (lua_pcall(m_luaState, 0, LUA_MULTRET, 0))
-                throw RuntimeError(m_luaState);
+            detail::BudgetCall budgetCall(m_luaState);
+            int status = lua_pcall(m_luaState, 0, LUA_MULTRET, 0);
+            if (status != LUA_OK)
+                detail::throwRuntimeError(m_luaState, status);
             
             int pushedValues = lua_gettop(m_luaState) - index;
-            return lua::Value(std::make_shared<detail::StackItem>(m_luaState, m_deallocQueue.get(), index, pushedValues, pushedValues > 0 ? pushedValues - 1 : 0));
+            return lua::Value(detail::makeStackItem(m_stackItemPool.get(), m_luaState, m_deallocQueue.get(), index, pushedValues, pushedValues > 0 ? pushedValues - 1 : 0));
         }
         
         void initialize(bool loadLibs)
         {
             m_deallocQueue.reset( new detail::DeallocQueue() );
-            m_luaState = luaL_newstate();
+            m_stackItemPool.reset( new detail::StackItemPool() );
+            m_luaState = lua_newstate(&BaseAllocator::luaAllocate, m_allocator.get());
             assert(m_luaState != nullptr);
+            lua_atpanic(m_luaState, &State::panicFunction);
+#if LUA_VERSION_NUM >= 504
+            lua_setwarnf(m_luaState, &State::warningOff, m_luaState);
+#endif
             
             if (loadLibs)
                 luaL_openlibs(m_luaState);
-            
-            
-            // We will create metatable for Lua functors for memory management and actual function call
-            luaL_newmetatable(m_luaState, "luaL_Functor");
-            
-            // Set up metatable call operator for functors
-            lua_pushcfunction(m_luaState, &State::metatableCallFunction);
-            lua_setfield(m_luaState, -2, "__call");
-            
-            // Set up metatable garbage collection for functors
-            lua_pushcfunction(m_luaState, &State::metatableDeleteFunction);
-            lua_setfield(m_luaState, -2, "__gc");
-            
-            // Pop metatable
-            lua_pop(m_luaState, 1);
+
+            // Metatable of functors pushed by user code, see lua::BaseFunctor
+            BaseFunctor::registerMetatable(m_luaState);
         }
         
     public:
@@ -90,12 +148,25 @@ namespace lua {
         ///
         /// @param loadLibs     If we want to open standard libraries - function luaL_openlibs
         explicit State(bool loadLibs = true)
+            : m_allocator(new AccountingAllocator())
+        {
+            initialize(loadLibs);
+        }
+        
+        /// Constructor creates new state, which will request all its memory from given allocator.
+        ///
+        /// @param allocator    Allocation policy, for example lua::PoolAllocator. State takes ownership of it
+        /// @param loadLibs     If we want to open standard libraries - function luaL_openlibs
+        explicit State(std::unique_ptr<BaseAllocator> allocator, bool loadLibs = true)
+            : m_allocator(new AccountingAllocator(std::move(allocator)))
         {
             initialize(loadLibs);
         }
         
         ~State()
         {
+            // Profiler removes itself from hook state, which is released by lua_close
+            stopProfiler();
             lua_close(m_luaState);
         }
         
@@ -108,7 +179,29 @@ namespace lua {
         /// @return Some value with type lua::Type
         Value operator[](lua::String name) const
         {
-            return Value(m_luaState, m_deallocQueue.get(), name);
+            return Value(m_luaState, m_deallocQueue.get(), m_stackItemPool.get(), name);
+        }
+        
+        /// Query global values from Lua state with interned key
+        ///
+        /// @return Some value with type lua::Type
+        Value operator[](const Key& key) const
+        {
+            int stackTop = lua_gettop(m_luaState);
+            lua_rawgeti(m_luaState, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+            traits::ValueTraits<Key>::get(m_luaState, -1, key);
+            lua_replace(m_luaState, -2);
+            return Value(detail::makeStackItem(m_stackItemPool.get(), m_luaState, m_deallocQueue.get(), stackTop, 1, 0));
+        }
+        
+        /// Interns string, which can be used as key many times without hashing it again
+        ///
+        /// @param name     String which will be interned
+        ///
+        /// @return Key, which can be used with operator[] and set functions of lua::State and lua::Value
+        Key createKey(const std::string& name) const
+        {
+            return Key(m_luaState, name);
         }
         
         /// Deleted compare operator
@@ -125,37 +218,137 @@ namespace lua {
             lua_setglobal(m_luaState, key);
         }
         
+        /// Sets global value to Lua state with interned key
+        ///
+        /// @param key      Stores value to _G[key]
+        /// @param value    Value witch will be stored to _G[key]
+        template<typename T>
+        void set(const Key& key, T&& value) const
+        {
+            lua_rawgeti(m_luaState, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+            traits::ValueTraits<Key>::push(m_luaState, key);
+            traits::ValueTraits<T>::push(m_luaState, std::forward<T>(value));
+            lua_settable(m_luaState, -3);
+            lua_pop(m_luaState, 1);
+        }
+        
+        /// Creates lua::Value from values which were pushed to stack with Lua C API. Value pops them when it is destroyed.
+        ///
+        /// @param pushedValues     Number of values on top of stack, returned value refers to first of them
+        Value adoptStackValues(int pushedValues = 1) const
+        {
+            int stackTop = lua_gettop(m_luaState) - pushedValues;
+            return Value(detail::makeStackItem(m_stackItemPool.get(), m_luaState, m_deallocQueue.get(), stackTop, pushedValues, pushedValues > 0 ? pushedValues - 1 : 0));
+        }
+        
+        /// Binds C++ class to Lua state, see lua::Class
+        ///
+        /// @param name     Name of global table with constructors and static functions of class
+        template<typename T>
+        Class<T> defineClass(const std::string& name) const
+        {
+            return Class<T>(m_luaState, name);
+        }
+        
         /// Executes file text on Lua state
         ///
-        /// @throws lua::LoadError      When file cannot be found or loaded
-        /// @throws lua::RuntimeError   When there is runtime error
+        /// @throws lua::LoadError          When file cannot be found or loaded
+        /// @throws lua::RuntimeError       When there is runtime error
+        /// @throws lua::MemoryLimitError   When memory limit was reached
         ///
         /// @param filePath File path indicating which file will be executed
         lua::Value doFile(const std::string& filePath) const
         {
             int stackTop = lua_gettop(m_luaState);
             
-            if (luaL_loadfile(m_luaState, filePath.c_str()))
-                throw LoadError(m_luaState);
+            int status = m_chunkCache ? m_chunkCache->load(m_luaState, filePath) : luaL_loadfile(m_luaState, filePath.c_str());
+            if (status != LUA_OK)
+                detail::throwLoadError(m_luaState, status);
             
             return executeLoadedFunction(stackTop);
         }
         
+        /// Enables caching of compiled files for doFile. Compiled chunks are stored in given directory and they are
+        /// used until source file is modified, so files don't need to be parsed again after restart of application.
+        ///
+        /// @note Cache directory must not be writable by untrusted users, because binary chunks are loaded without verification
+        ///
+        /// @param directory    Existing directory for compiled chunks, empty string disables caching
+        void setChunkCacheDirectory(const std::string& directory)
+        {
+            if (directory.empty())
+                m_chunkCache.reset();
+            else
+                m_chunkCache.reset(new ChunkCache(directory));
+        }
+        
+        /// @return Cache of compiled files, or nullptr when caching is disabled
+        const ChunkCache* getChunkCache() const
+        {
+            return m_chunkCache.get();
+        }
+        
         /// Execute string on Lua state
         ///
-        /// @throws lua::LoadError      When string cannot be loaded
-        /// @throws lua::RuntimeError   When there is runtime error
+        /// @throws lua::LoadError          When string cannot be loaded
+        /// @throws lua::RuntimeError       When there is runtime error
+        /// @throws lua::MemoryLimitError   When memory limit was reached
         ///
         /// @param string   Command which will be executed
         lua::Value doString(const std::string& string) const
         {
             int stackTop = lua_gettop(m_luaState);
             
-            if (luaL_loadstring(m_luaState, string.c_str()))
-                throw LoadError(m_luaState);
+            // Source is used also as chunk name, same as in luaL_loadstring
+            int status = luaL_loadbuffer(m_luaState, string.data(), string.length(), string.c_str());
+            if (status != LUA_OK)
+                detail::throwLoadError(m_luaState, status);
 
             return executeLoadedFunction(stackTop);
         }
+        
+        /// Compiles Lua code without executing it. Returned chunk can be executed many times without parsing.
+        ///
+        /// @throws lua::LoadError          When code cannot be compiled
+        /// @throws lua::MemoryLimitError   When memory limit was reached
+        ///
+        /// @param source       Lua source code or binary chunk, it doesn't need to be zero terminated
+        /// @param length       Length of source in bytes
+        /// @param chunkName    Name of chunk used in error messages and debug information
+        Chunk compile(const char* source, std::size_t length, const std::string& chunkName = "=chunk") const
+        {
+            int status = luaL_loadbuffer(m_luaState, source, length, chunkName.c_str());
+            if (status != LUA_OK)
+                detail::throwLoadError(m_luaState, status);
+            
+            return Chunk(m_luaState, m_deallocQueue.get(), m_stackItemPool.get());
+        }
+        
+#ifdef LUASTATE_CXX17
+        /// Compiles Lua code without executing it. Returned chunk can be executed many times without parsing.
+        ///
+        /// @throws lua::LoadError          When code cannot be compiled
+        /// @throws lua::MemoryLimitError   When memory limit was reached
+        ///
+        /// @param source       Lua source code or binary chunk
+        /// @param chunkName    Name of chunk used in error messages and debug information
+        Chunk compile(std::string_view source, const std::string& chunkName = "=chunk") const
+        {
+            return compile(source.data(), source.length(), chunkName);
+        }
+#else
+        /// Compiles Lua code without executing it. Returned chunk can be executed many times without parsing.
+        ///
+        /// @throws lua::LoadError          When code cannot be compiled
+        /// @throws lua::MemoryLimitError   When memory limit was reached
+        ///
+        /// @param source       Lua source code or binary chunk
+        /// @param chunkName    Name of chunk used in error messages and debug information
+        Chunk compile(const std::string& source, const std::string& chunkName = "=chunk") const
+        {
+            return compile(source.data(), source.length(), chunkName);
+        }
+#endif
 
 #ifdef LUASTATE_DEBUG_MODE
         
@@ -178,11 +371,9 @@ namespace lua {
             if (!m_deallocQueue->empty())
             {
                 std::cout << "Deallocation queue has " << m_deallocQueue->size() << " elements:";
-                while (!m_deallocQueue->empty())
-                {
-                    std::cout << "[stackCap = " << m_deallocQueue->top().end << ", numElements = " << m_deallocQueue->top().size << "]";
-                    m_deallocQueue->pop();
-                }
+                for (const detail::DeallocStackItem& item : m_deallocQueue->items())
+                    std::cout << "[stackCap = " << item.end << ", numElements = " << item.size << "]";
+                m_deallocQueue->clear();
                 noLeaks = false;
             }
             assert(noLeaks);
@@ -202,6 +393,82 @@ namespace lua {
             return m_luaState;
         }
         
+        /// Get allocator which was passed to constructor
+        ///
+        /// @return Allocator of Lua state, or nullptr when Lua state uses default allocator
+        BaseAllocator* getAllocator() const
+        {
+            return m_allocator->getAllocator();
+        }
+        
+        /// Sets maximum number of bytes which Lua state can allocate. When limit is reached, allocations fail and
+        /// protected calls throw lua::MemoryLimitError.
+        ///
+        /// @param bytes    Memory limit, zero means no limit
+        void setMemoryLimit(std::size_t bytes)
+        {
+            m_allocator->setLimit(bytes);
+        }
+        
+        /// @return Memory limit in bytes, zero when there is no limit
+        std::size_t getMemoryLimit() const
+        {
+            return m_allocator->getLimit();
+        }
+        
+        /// Sets budget of each protected call made through this state, its values or chunks: doString, doFile,
+        /// lua::Value::call, lua::Chunk::call and lua::Coroutine::resume. Nested calls from bound functions share budget
+        /// of outermost call and new budget applies from next outermost call. When budget is exceeded, call throws
+        /// lua::ExecutionLimitError. Unprotected calls outside of them aren't limited. Coroutines resumed by scripts
+        /// count to budget of call which resumes them, see lua::detail::getHookState for exceptions.
+        ///
+        /// @param budget   Limits of each call, budget without limits removes them and their count hook
+        void setExecutionBudget(const ExecutionBudget& budget)
+        {
+            // Counters are started by each call, hook only lets calls know that they have budget
+            detail::HookState& state = detail::getHookState(m_luaState);
+            state.stateBudget = budget;
+            detail::scheduleHook(m_luaState, state);
+        }
+        
+        /// @return Budget of each call, see setExecutionBudget
+        ExecutionBudget getExecutionBudget() const
+        {
+            detail::HookState* state = detail::findHookState(m_luaState);
+            return state != nullptr ? state->stateBudget : ExecutionBudget();
+        }
+        
+        /// Starts sampling profiler of this state, see lua::Profiler. Samples are added to samples from previous runs.
+        ///
+        /// @param sampleIntervalInstructions   Number of Lua instructions between two samples
+        void startProfiler(int sampleIntervalInstructions = 10000)
+        {
+            if (!m_profiler)
+                m_profiler.reset(new Profiler());
+            m_profiler->start(m_luaState, sampleIntervalInstructions);
+        }
+        
+        /// Stops sampling profiler, collected samples are kept
+        void stopProfiler()
+        {
+            if (m_profiler)
+                m_profiler->stop();
+        }
+        
+        /// @return Profiler with collected samples, nullptr when profiler was never started
+        Profiler* getProfiler() const
+        {
+            return m_profiler.get();
+        }
+        
+        /// Number of bytes allocated by Lua state. It is counted by allocator, so it is cheap to query.
+        ///
+        /// @return Current memory usage in bytes
+        std::size_t getMemoryUsage() const
+        {
+            return m_allocator->getUsedBytes();
+        }
+        
         
         //////////////////////////////////////////////////////////////////////////////////////////////
         // Conventional setting functions
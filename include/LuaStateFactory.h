@@ -0,0 +1,224 @@
+//
+//  LuaStateFactory.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaState.h"
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace lua {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Creates states with same functions and init scripts. Scripts are compiled only once, when they are added to factory,
+    /// and functions are collected to luaL_Reg array, so new state only loads binary chunks and registers array at once.
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// lua::StateFactory factory;
+    /// factory.addFunction("log", &luaLog);
+    /// factory.addFile("init.lua");
+    ///
+    /// std::unique_ptr<lua::State> state = factory.create();
+    /// std::chrono::nanoseconds latency = factory.getStatistics().lastLatency;
+    /// ~~~~~~~~~~~~~~~
+    ///
+    /// @note Factory must not be changed while other threads create states
+    class StateFactory final
+    {
+    public:
+
+        /// Latencies of created states, they include creation of Lua state, opening of libraries and init scripts
+        struct Statistics
+        {
+            /// Number of created or initialized states
+            std::size_t created = 0;
+
+            std::chrono::nanoseconds lastLatency{ 0 };
+
+            std::chrono::nanoseconds maxLatency{ 0 };
+
+            std::chrono::nanoseconds totalLatency{ 0 };
+
+            /// @return Average latency of all created states
+            std::chrono::nanoseconds averageLatency() const
+            {
+                return created == 0 ? std::chrono::nanoseconds(0) : totalLatency / static_cast<std::chrono::nanoseconds::rep>(created);
+            }
+        };
+
+    private:
+
+        struct Script
+        {
+            std::string name;
+            std::string chunk;
+        };
+
+        /// Binary chunks of init scripts in order in which they are executed
+        std::vector<Script> m_scripts;
+
+        /// Names of functions, deque keeps their addresses when new names are added
+        std::deque<std::string> m_names;
+
+        /// Functions registered to globals, it is terminated by empty entry as luaL_setfuncs requires
+        std::vector<luaL_Reg> m_functions;
+
+        bool m_loadLibs;
+
+        mutable std::mutex m_mutex;
+        mutable Statistics m_statistics;
+
+        /// Dumps function from top of scratch state and closes that state
+        void addCompiled(lua_State* luaState, int status, const std::string& name)
+        {
+            std::unique_ptr<lua_State, void(*)(lua_State*)> guard(luaState, &lua_close);
+            if (status != LUA_OK)
+                detail::throwLoadError(luaState, status);
+
+            m_scripts.push_back({ name, detail::dumpFunction(luaState) });
+        }
+
+        /// Registers functions from luaL_Reg array passed as light userdata to globals, it is called in protected mode
+        static int registerFunctions(lua_State* luaState)
+        {
+            const luaL_Reg* functions = static_cast<const luaL_Reg*>(lua_touserdata(luaState, 1));
+            lua_rawgeti(luaState, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+            luaL_setfuncs(luaState, functions, 0);
+            return 0;
+        }
+
+        /// Registers functions to globals and executes init scripts
+        void load(lua_State* luaState) const
+        {
+            // State can have memory limit, so registration can fail
+            lua_pushcfunction(luaState, &StateFactory::registerFunctions);
+            lua_pushlightuserdata(luaState, const_cast<luaL_Reg*>(m_functions.data()));
+            int status = lua_pcall(luaState, 1, 0, 0);
+            if (status != LUA_OK)
+                detail::throwRuntimeError(luaState, status);
+
+            for (const Script& script : m_scripts)
+            {
+                status = luaL_loadbuffer(luaState, script.chunk.data(), script.chunk.length(), script.name.c_str());
+                if (status != LUA_OK)
+                    detail::throwLoadError(luaState, status);
+
+                status = lua_pcall(luaState, 0, 0, 0);
+                if (status != LUA_OK)
+                    detail::throwRuntimeError(luaState, status);
+            }
+        }
+
+        void record(std::chrono::steady_clock::time_point start) const
+        {
+            auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_statistics.created;
+            m_statistics.lastLatency = latency;
+            m_statistics.totalLatency += latency;
+            if (latency > m_statistics.maxLatency)
+                m_statistics.maxLatency = latency;
+        }
+
+    public:
+
+        /// @param loadLibs     If created states should open standard libraries
+        explicit StateFactory(bool loadLibs = true)
+            : m_loadLibs(loadLibs)
+        {
+            m_functions.push_back({ nullptr, nullptr });
+        }
+
+        // Factory is non-copyable
+        StateFactory(const StateFactory&) = delete;
+        StateFactory& operator=(const StateFactory&) = delete;
+
+        /// Adds global function, which will be registered in every created state
+        void addFunction(const std::string& name, lua_CFunction function)
+        {
+            m_names.push_back(name);
+            m_functions.back() = { m_names.back().c_str(), function };
+            m_functions.push_back({ nullptr, nullptr });
+        }
+
+        /// Adds all functions from array terminated by entry with nullptr name
+        void addFunctions(const luaL_Reg* functions)
+        {
+            for (; functions->name != nullptr; ++functions)
+                addFunction(functions->name, functions->func);
+        }
+
+        /// Compiles init script, which will be executed in every created state after previously added scripts
+        ///
+        /// @throws lua::LoadError  When script cannot be compiled
+        ///
+        /// @param source       Lua source code
+        /// @param chunkName    Name of chunk used in error messages and debug information
+        void addScript(const std::string& source, const std::string& chunkName = "=init")
+        {
+            lua_State* luaState = luaL_newstate();
+            addCompiled(luaState, luaL_loadbuffer(luaState, source.data(), source.length(), chunkName.c_str()), chunkName);
+        }
+
+        /// Compiles init file, which will be executed in every created state after previously added scripts
+        ///
+        /// @throws lua::LoadError  When file cannot be loaded or compiled
+        void addFile(const std::string& filePath)
+        {
+            lua_State* luaState = luaL_newstate();
+            addCompiled(luaState, luaL_loadfile(luaState, filePath.c_str()), "@" + filePath);
+        }
+
+        /// Registers functions and executes init scripts in given state. It can be used as initializer of lua::StatePool.
+        ///
+        /// @throws lua::RuntimeError       When init script fails
+        /// @throws lua::MemoryLimitError   When memory limit was reached
+        void initialize(State& state) const
+        {
+            auto start = std::chrono::steady_clock::now();
+            load(state.getState());
+            record(start);
+        }
+
+        /// Creates new initialized state
+        ///
+        /// @throws lua::RuntimeError       When init script fails
+        /// @throws lua::MemoryLimitError   When memory limit was reached
+        std::unique_ptr<State> create() const
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<State> state(new State(m_loadLibs));
+            load(state->getState());
+            record(start);
+            return state;
+        }
+
+        /// @return Number of init scripts
+        std::size_t getScriptCount() const
+        {
+            return m_scripts.size();
+        }
+
+        /// @return Number of registered functions
+        std::size_t getFunctionCount() const
+        {
+            return m_names.size();
+        }
+
+        /// @return Latencies of created states
+        Statistics getStatistics() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_statistics;
+        }
+    };
+}
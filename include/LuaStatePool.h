@@ -0,0 +1,470 @@
+//
+//  LuaStatePool.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "LuaState.h"
+
+#include <cassert>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace lua {
+
+    /// Pins calling thread to one of CPUs which it is allowed to use, so cgroup and taskset restrictions are respected
+    ///
+    /// @param cpu  Index of CPU among allowed CPUs, it is wrapped to their number
+    ///
+    /// @return False when thread affinity is not supported on this platform or it couldn't be set
+    inline bool pinCurrentThread(std::size_t cpu)
+    {
+#ifdef __linux__
+        cpu_set_t allowed;
+        if (pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) != 0)
+            return false;
+
+        int count = CPU_COUNT(&allowed);
+        if (count == 0)
+            return false;
+
+        std::size_t remaining = cpu % static_cast<std::size_t>(count);
+        for (int index = 0; index < CPU_SETSIZE; ++index)
+        {
+            if (!CPU_ISSET(index, &allowed) || remaining-- > 0)
+                continue;
+
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(index, &set);
+            return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+        }
+        return false;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
+    namespace detail {
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Affinity of thread before it was pinned, so it can be restored when thread doesn't need pinning anymore
+        class SavedAffinity
+        {
+#ifdef __linux__
+            pthread_t m_thread;
+            cpu_set_t m_set;
+#endif
+            bool m_saved = false;
+
+        public:
+
+            /// Saves affinity of calling thread and pins it, see lua::pinCurrentThread
+            ///
+            /// @return False when thread couldn't be pinned, affinity is unchanged then
+            bool pinCurrentThread(std::size_t cpu)
+            {
+#ifdef __linux__
+                m_thread = pthread_self();
+                if (pthread_getaffinity_np(m_thread, sizeof(m_set), &m_set) != 0)
+                    return false;
+
+                m_saved = lua::pinCurrentThread(cpu);
+#else
+                (void)cpu;
+#endif
+                return m_saved;
+            }
+
+            /// Restores saved affinity of pinned thread, it can be called from other thread
+            void restore()
+            {
+#ifdef __linux__
+                if (m_saved)
+                    pthread_setaffinity_np(m_thread, sizeof(m_set), &m_set);
+#endif
+                m_saved = false;
+            }
+
+            /// @return True when thread is pinned and its previous affinity is saved
+            bool isSaved() const
+            {
+                return m_saved;
+            }
+        };
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Pool of Lua states, which are created and initialized in advance. States are handed out with lua::StatePool::Lease
+    /// and when lease is destroyed, global variables, memory limit and execution budget of state are reset to values which
+    /// they had after initialization and profiler started by lease is stopped and cleared.
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// lua::StatePool pool(4, [](lua::State& state) {
+    ///     state.set("log", &log);
+    ///     state.doFile("init.lua");
+    /// });
+    ///
+    /// // In worker thread
+    /// lua::StatePool::Lease lease = pool.acquire();
+    /// lease->doString(request);
+    /// ~~~~~~~~~~~~~~~
+    ///
+    /// @note Only globals themselves are reset, tables which were changed in place keep their changes. lua::Value
+    ///       instances of leased state must be destroyed before the lease.
+    class StatePool final
+    {
+    public:
+
+        /// Function which prepares new state: binds functions, executes init scripts...
+        using Initializer = std::function<void(State&)>;
+
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Exclusive access to one state of pool. State is returned to pool when lease is destroyed
+        class Lease final
+        {
+            friend class StatePool;
+
+            StatePool* m_pool = nullptr;
+            std::size_t m_index = 0;
+
+            /// Affinity of thread which acquired lease, when pool pinned it
+            detail::SavedAffinity m_affinity;
+
+            Lease(StatePool* pool, std::size_t index)
+                : m_pool(pool)
+                , m_index(index)
+            {
+            }
+
+        public:
+
+            /// Creates empty lease which has no state
+            Lease() = default;
+
+            /// Errors of release are ignored here, call release to handle them
+            ~Lease()
+            {
+                try {
+                    release();
+                } catch (...) {
+                }
+            }
+
+            // Lease is movable but not copyable
+            Lease(const Lease&) = delete;
+            Lease& operator=(const Lease&) = delete;
+
+            Lease(Lease&& other) noexcept
+                : m_pool(other.m_pool)
+                , m_index(other.m_index)
+                , m_affinity(other.m_affinity)
+            {
+                other.m_pool = nullptr;
+                other.m_affinity = detail::SavedAffinity();
+            }
+
+            Lease& operator=(Lease&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    try {
+                        release();
+                    } catch (...) {
+                    }
+                    m_pool = other.m_pool;
+                    m_index = other.m_index;
+                    m_affinity = other.m_affinity;
+                    other.m_pool = nullptr;
+                    other.m_affinity = detail::SavedAffinity();
+                }
+                return *this;
+            }
+
+            /// Resets state, restores affinity of pinned thread and returns state to pool, lease will be empty
+            ///
+            /// @throws lua::MemoryLimitError   When globals couldn't be reset, state is returned to pool anyway
+            void release()
+            {
+                if (m_pool == nullptr)
+                    return;
+
+                StatePool* pool = m_pool;
+                m_pool = nullptr;
+                m_affinity.restore();
+                pool->release(m_index);
+            }
+
+            /// @return True when lease holds some state
+            bool isValid() const
+            {
+                return m_pool != nullptr;
+            }
+
+            explicit operator bool() const
+            {
+                return isValid();
+            }
+
+            /// @return Index of state in pool, it is also index of allowed CPU to which thread is pinned
+            std::size_t getIndex() const
+            {
+                return m_index;
+            }
+
+            /// @return True when pool pinned thread which acquired lease, its affinity is restored on release
+            bool isPinned() const
+            {
+                return m_affinity.isSaved();
+            }
+
+            State& operator*() const
+            {
+                assert(isValid());
+                return *m_pool->m_states[m_index];
+            }
+
+            State* operator->() const
+            {
+                return &operator*();
+            }
+        };
+
+    private:
+
+        /// Created states, they live as long as pool
+        std::vector<std::unique_ptr<State>> m_states;
+
+        /// Settings of state after initialization, they are restored when lease is released
+        struct Baseline
+        {
+            /// Reference to table with copy of globals, in LUA_REGISTRYINDEX of that state
+            int globals;
+
+            std::size_t memoryLimit;
+            ExecutionBudget budget;
+        };
+
+        /// Baseline of each state
+        std::vector<Baseline> m_baselines;
+
+        /// Indexes of states which are not leased. Last returned state is leased first, because its memory is most
+        /// likely still in cache
+        std::vector<std::size_t> m_free;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_released;
+
+        /// If threads which acquire states should be pinned to CPU with index of their state
+        bool m_pinThreads;
+
+        /// Stores copy of global table to registry
+        ///
+        /// @return Reference to copied table
+        static int storeBaseline(lua_State* luaState)
+        {
+            lua_newtable(luaState);
+            lua_rawgeti(luaState, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+
+            lua_pushnil(luaState);
+            while (lua_next(luaState, -2) != 0)
+            {
+                lua_pushvalue(luaState, -2);
+                lua_insert(luaState, -2);
+                lua_rawset(luaState, -5);
+            }
+
+            lua_pop(luaState, 1);
+            return luaL_ref(luaState, LUA_REGISTRYINDEX);
+        }
+
+        /// Removes new globals and restores changed or removed ones. Only existing fields are changed during traversal,
+        /// which Lua allows, missing globals are added afterwards. Reference to baseline is the only argument, function
+        /// is called in protected mode, because adding globals can fail to allocate memory.
+        static int restoreBaseline(lua_State* luaState)
+        {
+            int baseline = static_cast<int>(lua_tointeger(luaState, 1));
+            lua_rawgeti(luaState, LUA_REGISTRYINDEX, baseline);
+            int saved = lua_gettop(luaState);
+            lua_rawgeti(luaState, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+            int globals = saved + 1;
+
+            lua_pushnil(luaState);
+            while (lua_next(luaState, globals) != 0)
+            {
+                lua_pushvalue(luaState, -2);
+                lua_rawget(luaState, saved);
+                if (!lua_rawequal(luaState, -1, -2))
+                {
+                    lua_pushvalue(luaState, -3);
+                    lua_insert(luaState, -2);
+                    lua_rawset(luaState, globals);
+                }
+                else
+                {
+                    lua_pop(luaState, 1);
+                }
+                lua_pop(luaState, 1);
+            }
+
+            lua_pushnil(luaState);
+            while (lua_next(luaState, saved) != 0)
+            {
+                lua_pushvalue(luaState, -2);
+                lua_rawget(luaState, globals);
+                bool missing = lua_isnil(luaState, -1);
+                lua_pop(luaState, 1);
+
+                if (missing)
+                {
+                    lua_pushvalue(luaState, -2);
+                    lua_insert(luaState, -2);
+                    lua_rawset(luaState, globals);
+                }
+                else
+                {
+                    lua_pop(luaState, 1);
+                }
+            }
+
+            return 0;
+        }
+
+        /// Restores baseline of state and returns it to free states. Profiler started by lease is stopped and its samples
+        /// are removed.
+        void release(std::size_t index)
+        {
+            State& state = *m_states[index];
+            const Baseline& baseline = m_baselines[index];
+            if (state.getProfiler() != nullptr)
+            {
+                state.stopProfiler();
+                state.getProfiler()->clear();
+            }
+            state.setExecutionBudget(baseline.budget);
+
+            // Baseline fitted into memory after initialization, so limit set by lease must not prevent restoring it
+            state.setMemoryLimit(0);
+            lua_State* luaState = state.getState();
+            lua_pushcfunction(luaState, &StatePool::restoreBaseline);
+            lua_pushinteger(luaState, baseline.globals);
+            int status = lua_pcall(luaState, 1, 0, 0);
+
+            // Error message must be taken before state can be leased by other thread
+            std::exception_ptr error;
+            if (status != LUA_OK)
+            {
+                try {
+                    detail::throwRuntimeError(luaState, status);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+            }
+            state.setMemoryLimit(baseline.memoryLimit);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_free.push_back(index);
+            }
+            m_released.notify_one();
+
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        Lease lease(std::unique_lock<std::mutex>& lock)
+        {
+            std::size_t index = m_free.back();
+            m_free.pop_back();
+            lock.unlock();
+
+            Lease lease(this, index);
+            if (m_pinThreads)
+                lease.m_affinity.pinCurrentThread(index);
+            return lease;
+        }
+
+    public:
+
+        /// Creates and initializes all states of pool
+        ///
+        /// @param size         Number of states, usually number of worker threads
+        /// @param initializer  Function called once for each created state
+        /// @param pinThreads   If threads acquiring states should be pinned to allowed CPU with same index as acquired state
+        ///                     while they hold lease, see lua::StatePool::Lease::isPinned
+        ///
+        /// @throws Exceptions thrown by initializer
+        StatePool(std::size_t size, const Initializer& initializer, bool pinThreads = false)
+            : m_pinThreads(pinThreads)
+        {
+            m_states.reserve(size);
+            m_baselines.reserve(size);
+            m_free.reserve(size);
+
+            for (std::size_t index = 0; index < size; ++index)
+            {
+                m_states.emplace_back(new State());
+                if (initializer)
+                    initializer(*m_states.back());
+
+                State& state = *m_states.back();
+                m_baselines.push_back(Baseline{ storeBaseline(state.getState()), state.getMemoryLimit(), state.getExecutionBudget() });
+                m_free.push_back(size - index - 1);
+            }
+        }
+
+        ~StatePool()
+        {
+            assert(m_free.size() == m_states.size() && "All leases must be released before pool is destroyed");
+        }
+
+        // Pool is non-copyable
+        StatePool(const StatePool&) = delete;
+        StatePool& operator=(const StatePool&) = delete;
+
+        /// Leases free state, waits when all states are leased
+        Lease acquire()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_released.wait(lock, [this]() { return !m_free.empty(); });
+            return lease(lock);
+        }
+
+        /// Leases free state without waiting
+        ///
+        /// @return Empty lease when all states are leased
+        Lease tryAcquire()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_free.empty())
+                return Lease();
+            return lease(lock);
+        }
+
+        /// @return Number of states in pool
+        std::size_t size() const
+        {
+            return m_states.size();
+        }
+
+        /// @return Number of states which are not leased
+        std::size_t available() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_free.size();
+        }
+    };
+}
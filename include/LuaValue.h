@@ -8,12 +8,15 @@
 
 #pragma once
 
+#include "LuaBudget.h"
 #include "LuaException.h"
 #include "LuaPrimitives.h"
 #include "LuaStackItem.h"
 
 #include <cassert>
-#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 namespace lua {
     
@@ -21,6 +24,215 @@ namespace lua {
     class State;
     class ValueReference;
     template<typename... Ts> class Return;
+    template<typename... Keys> class Path;
+    
+    namespace detail {
+        template<typename K> struct PathKey;
+    }
+
+    namespace detail {
+        
+        /// Stores value to table at given index without invoking metamethods. Integer keys are stored with lua_rawseti.
+        template<typename K, typename T>
+        inline void rawSet(lua_State* luaState, int index, K&& key, T&& value, std::true_type)
+        {
+            traits::ValueTraits<T>::push(luaState, std::forward<T>(value));
+            lua_rawseti(luaState, index, key);
+        }
+        
+        template<typename K, typename T>
+        inline void rawSet(lua_State* luaState, int index, K&& key, T&& value, std::false_type)
+        {
+            traits::ValueTraits<K>::push(luaState, std::forward<K>(key));
+            traits::ValueTraits<T>::push(luaState, std::forward<T>(value));
+            lua_rawset(luaState, index);
+        }
+        
+        template<typename K, typename T>
+        inline void rawSet(lua_State* luaState, int index, K&& key, T&& value)
+        {
+            using Key = typename std::decay<K>::type;
+            using IsIndex = std::integral_constant<bool, std::is_integral<Key>::value && !std::is_same<Key, bool>::value>;
+            rawSet(luaState, index, std::forward<K>(key), std::forward<T>(value), IsIndex());
+        }
+        
+        inline void rawSetMany(lua_State*, int)
+        {
+        }
+        
+        template<typename K, typename T, typename... Ts>
+        inline void rawSetMany(lua_State* luaState, int index, K&& key, T&& value, Ts&&... keysAndValues)
+        {
+            rawSet(luaState, index, std::forward<K>(key), std::forward<T>(value));
+            rawSetMany(luaState, index, std::forward<Ts>(keysAndValues)...);
+        }
+        
+        /// Appends elements of range to array part of table, or stores pairs of range as keys and values
+        template<typename Iterator>
+        inline void rawSetRange(lua_State* luaState, int index, Iterator first, Iterator last, std::false_type)
+        {
+            lua::Integer key = static_cast<lua::Integer>(lua_rawlen(luaState, index));
+            for (; first != last; ++first)
+            {
+                traits::ValueTraits<decltype(*first)>::push(luaState, *first);
+                lua_rawseti(luaState, index, ++key);
+            }
+        }
+        
+        template<typename Iterator>
+        inline void rawSetRange(lua_State* luaState, int index, Iterator first, Iterator last, std::true_type)
+        {
+            for (; first != last; ++first)
+                rawSet(luaState, index, first->first, first->second);
+        }
+        
+        template<typename T>
+        struct IsPair : std::false_type {};
+        
+        template<typename T1, typename T2>
+        struct IsPair<std::pair<T1, T2>> : std::true_type {};
+        
+        //////////////////////////////////////////////////////////////////////////////////////////////
+        /// Conventional conversion and setting functions shared by lua::Value and lua::Path. Derived class provides
+        /// to, is, get, set and setString functions.
+        template<typename Derived>
+        class ValueAccessors
+        {
+            const Derived& derived() const
+            {
+                return static_cast<const Derived&>(*this);
+            }
+            
+        public:
+            
+            //////////////////////////////////////////////////////////////////////////////////////////////
+            // Conventional conversion functions
+
+            // to
+        
+            const char* toCStr() const
+            {
+                return derived().template to<const char*>();
+            }
+        
+            std::string toString() const
+            {
+                return derived().template to<std::string>();
+            }
+        
+            lua::Number toNumber() const
+            {
+                return derived().template to<lua::Number>();
+            }
+        
+            float toFloat() const
+            {
+                return derived().template to<float>();
+            }
+
+            lua::Integer toInt() const
+            {
+                return derived().template to<lua::Integer>();
+            }
+        
+            lua::Unsigned toUInt() const
+            {
+                return derived().template to<lua::Unsigned>();
+            }
+
+            lua::Boolean toBool() const
+            {
+                return derived().template to<lua::Boolean>();
+            }
+
+            bool isNil() const
+            {
+                return derived().template is<lua::Nil>();
+            }
+
+            /// Will get pointer casted to given template type
+            ///
+            /// @return Pointer staticaly casted to given template type
+            template <typename T>
+            T* toPtr() const
+            {
+                return static_cast<T*>(derived().template to<Pointer>());
+            }
+        
+            // get
+        
+            bool getCStr(const char*& cstr) const
+            {
+                return derived().template get<const char*>(cstr);
+            }
+        
+            bool getString(std::string& string) const
+            {
+                return derived().template get<std::string>(string);
+            }
+        
+            bool getNumber(lua::Number number) const
+            {
+                return derived().template get<lua::Number>(number);
+            }
+        
+            bool getInt(lua::Integer number) const
+            {
+                return derived().template get<lua::Integer>(number);
+            }
+        
+            template <typename T>
+            T* getPtr(T*& pointer) const
+            {
+                lua::Pointer cptr;
+                bool success = derived().template get<lua::Pointer>(cptr);
+            
+                if (success)
+                    pointer = static_cast<T*>(cptr);
+            
+                return success;
+            }
+        
+            //////////////////////////////////////////////////////////////////////////////////////////////
+            // Conventional setting functions
+        
+            template<typename K>
+            void setCStr(K&& key, lua::String value) const
+            {
+                derived().template set<const char*>(std::forward<K>(key), value);
+            }
+        
+            template<typename K>
+            void set(K&& key, std::string&& value) const
+            {
+                derived().template setString<lua::String>(std::forward<K>(key), std::forward<std::string>(value));
+            }
+        
+            template<typename K>
+            void setNumber(K&& key, lua::Number number) const
+            {
+                derived().template set<lua::Number>(std::forward<K>(key), number);
+            }
+        
+            template<typename K>
+            void setInt(K&& key, int number) const
+            {
+                derived().template set<int>(std::forward<K>(key), number);
+            }
+        
+            template<typename K>
+            void setFloat(K&& key, float number) const
+            {
+                derived().template set<float>(std::forward<K>(key), number);
+            }
+        
+            template<typename K>
+            void setDouble(K&& key, double number) const
+            {
+                derived().template set<double>(std::forward<K>(key), number);
+            }
+        };
+    }
 
     //////////////////////////////////////////////////////////////////////////////////////////////
     /// This is class for:
@@ -28,21 +240,23 @@ namespace lua {
     /// * setting values to lua tables,
     /// * calling values as functions,
     /// * checking value type.
-    class Value
+    class Value : public detail::ValueAccessors<Value>
     {
         friend class State;
         friend class ValueReference;
         template <typename... Ts> friend class Return;
+        template <typename... Keys> friend class Path;
         
-        std::shared_ptr<detail::StackItem> m_stack = nullptr;
+        detail::StackItemPtr m_stack = nullptr;
         
         /// Constructor for lua::State class. Whill get global in _G table with name
         ///
         /// @param luaState     Pointer of Lua state
         /// @param deallocQueue Queue for deletion values initialized from given luaState
+        /// @param pool         Pool for stack items of given luaState
         /// @param name         Key of global value
-        Value(lua_State* luaState, detail::DeallocQueue* deallocQueue, const char* name)
-            : m_stack(std::make_shared<detail::StackItem>(luaState, deallocQueue, lua_gettop(luaState), 1, 0))
+        Value(lua_State* luaState, detail::DeallocQueue* deallocQueue, detail::StackItemPool* pool, const char* name)
+            : m_stack(detail::makeStackItem(pool, luaState, deallocQueue, lua_gettop(luaState), 1, 0))
         {
             lua_getglobal(m_stack->state, name);
         }
@@ -57,11 +271,14 @@ namespace lua {
 
             if (protectedCall)
             {
-                if (lua_pcall(m_stack->state, argCount, LUA_MULTRET, 0))
-                    throw RuntimeError(m_stack->state);
+                detail::BudgetCall budgetCall(m_stack->state);
+                int status = lua_pcall(m_stack->state, argCount, LUA_MULTRET, 0);
+                if (status != LUA_OK)
+                    detail::throwRuntimeError(m_stack->state, status);
             }
             else
             {
+                detail::startUnprotectedCall(m_stack->state);
                 lua_call(m_stack->state, argCount, LUA_MULTRET);
             }
         }
@@ -80,7 +297,7 @@ namespace lua {
             
             assert(returnedValues >= 0);
             
-            return Value(std::make_shared<detail::StackItem>(m_stack->state, m_stack->deallocQueue, stackTop, returnedValues, returnedValues == 0 ? 0 : returnedValues - 1));
+            return Value(detail::makeStackItem(m_stack->pool, m_stack->state, m_stack->deallocQueue, stackTop, returnedValues, returnedValues == 0 ? 0 : returnedValues - 1));
         }
         
         template<typename... Ts>
@@ -125,18 +342,21 @@ namespace lua {
         /// Constructor for returning values from functions and for creating lua::Ref instances
         ///
         /// @param stackItem Prepared stack item
-        Value(std::shared_ptr<detail::StackItem>&& stackItem)
+        Value(detail::StackItemPtr&& stackItem)
             : m_stack(std::move(stackItem))
         {
         }
         
-        /// With this function we will create lua::Ref instance
+        using detail::ValueAccessors<Value>::set;
+        
+        /// Query value from table. Lookup is lazy, it is evaluated when returned path is read, set or called, and
+        /// chained lookups take only one stack slot.
         ///
         /// @note This function doesn't check if current value is lua::Table. You must use is<lua::Table>() function if you want to be sure
         template<typename T>
-        Value operator[](T&& key) const {
-            traits::ValueTraits<T>::get(m_stack->state, m_stack->top + m_stack->pushed - m_stack->grouped, std::forward<T>(key));
-            return Value(std::make_shared<detail::StackItem>(m_stack->state, m_stack->deallocQueue, lua_gettop(m_stack->state) - 1, 1, 0));
+        Path<typename std::decay<T>::type> operator[](T&& key) const {
+            using KeyType = typename std::decay<T>::type;
+            return Path<KeyType>(*this, std::make_tuple(detail::PathKey<KeyType>::store(std::forward<T>(key))));
         }
         
         /// Call given value.
@@ -176,6 +396,32 @@ namespace lua {
             lua_settable(m_stack->state, m_stack->top + m_stack->pushed - m_stack->grouped);
         }
 
+        /// Set many values to table at once. Values are stored without invoking metamethods and integer keys are
+        /// stored directly to array part of table. Create table with lua::Table size hint to avoid rehashing.
+        ///
+        /// @param keysAndValues    Pairs of keys and values: key1, value1, key2, value2...
+        ///
+        /// @note This function doesn't check if current value is lua::Table. You must use is<lua::Table>() function if you want to be sure
+        template<typename... Ts>
+        void setMany(Ts&&... keysAndValues) const
+        {
+            static_assert(sizeof...(Ts) % 2 == 0, "Keys and values must be passed in pairs");
+            luaL_checkstack(m_stack->state, 2, nullptr);
+            detail::rawSetMany(m_stack->state, m_stack->top + m_stack->pushed - m_stack->grouped, std::forward<Ts>(keysAndValues)...);
+        }
+        
+        /// Append elements of range to array part of table. When range contains std::pair elements (for example
+        /// std::map), they are stored as keys and values. Values are stored without invoking metamethods.
+        ///
+        /// @note This function doesn't check if current value is lua::Table. You must use is<lua::Table>() function if you want to be sure
+        template<typename Iterator>
+        void setRange(Iterator first, Iterator last) const
+        {
+            using IsPair = detail::IsPair<typename std::decay<decltype(*first)>::type>;
+            luaL_checkstack(m_stack->state, 2, nullptr);
+            detail::rawSetRange(m_stack->state, m_stack->top + m_stack->pushed - m_stack->grouped, first, last, IsPair());
+        }
+
         /// Check if queryied value is some type from LuaPrimitives.h file
         ///
         /// @return true if yes false if no
@@ -204,6 +450,12 @@ namespace lua {
             }
         }
             
+        /// @returns Lua state in which is value stored
+        lua_State* getLuaState() const
+        {
+            return m_stack->state;
+        }
+        
         /// @returns Value position on stack
         int getStackIndex() const
         {
@@ -211,109 +463,11 @@ namespace lua {
             return m_stack->top + 1;
         }
         
-        //////////////////////////////////////////////////////////////////////////////////////////////
-        // Conventional conversion functions
-
-        // to
-        
-        const char* toCStr() const
-        {
-            return to<const char*>();
-        }
-        
-        std::string toString() const
-        {
-            return to<std::string>();
-        }
-        
-        lua::Number toNumber() const
-        {
-            return to<lua::Number>();
-        }
-        
-        float toFloat() const
-        {
-            return to<float>();
-        }
-
-        lua::Integer toInt() const
-        {
-            return to<lua::Integer>();
-        }
-        
-        lua::Unsigned toUInt() const
-        {
-            return to<lua::Unsigned>();
-        }
-
-        lua::Boolean toBool() const
-        {
-            return to<lua::Boolean>();
-        }
-
-        bool isNil() const
+        size_t length() const
         {
-            return is<lua::Nil>();
+            return lua_rawlen(m_stack->state, m_stack->top + m_stack->pushed - m_stack->grouped);
         }
 
-        /// Will get pointer casted to given template type
-        ///
-        /// @return Pointer staticaly casted to given template type
-        template <typename T>
-        T* toPtr() const
-        {
-            return static_cast<T*>(to<Pointer>());
-        }
-        
-        // get
-        
-        bool getCStr(const char*& cstr) const
-        {
-            return get<const char*>(cstr);
-        }
-        
-        bool getString(std::string& string) const
-        {
-            lua::String cstr;
-            bool success = get<lua::String>(cstr);
-            
-            if (success)
-                string = cstr;
-            
-            return success;
-        }
-        
-        bool getNumber(lua::Number number) const
-        {
-            return get<lua::Number>(number);
-        }
-        
-        bool getInt(lua::Integer number) const
-        {
-            return get<lua::Integer>(number);
-        }
-        
-        template <typename T>
-        T* getPtr(T*& pointer) const
-        {
-            lua::Pointer cptr;
-            bool success = get<lua::Pointer>(cptr);
-            
-            if (success)
-                pointer = static_cast<T*>(cptr);
-            
-            return success;
-        }
-        
-        //////////////////////////////////////////////////////////////////////////////////////////////
-        // Conventional setting functions
-        
-        template<typename K>
-        void setCStr(K&& key, lua::String value) const
-        {
-            set<const char*>(std::forward<K>(key), value);
-        }
-        
         template<typename K>
         void setData(K&& key, lua::String value, size_t length) const
         {
@@ -329,41 +483,6 @@ namespace lua {
             traits::ValueTraits<lua::String>::push(m_stack->state, string.c_str(), string.length());
             lua_settable(m_stack->state, m_stack->top + m_stack->pushed - m_stack->grouped);
         }
-        
-        size_t length() const
-        {
-            return lua_rawlen(m_stack->state, m_stack->top + m_stack->pushed - m_stack->grouped);
-        }
-
-        template<typename K>
-        void set(K&& key, std::string&& value) const
-        {
-            setString<lua::String>(std::forward<K>(key), std::forward<std::string>(value));
-        }
-        
-        template<typename K>
-        void setNumber(K&& key, lua::Number number) const
-        {
-            set<lua::Number>(std::forward<K>(key), number);
-        }
-        
-        template<typename K>
-        void setInt(K&& key, int number) const
-        {
-            set<int>(std::forward<K>(key), number);
-        }
-        
-        template<typename K>
-        void setFloat(K&& key, float number) const
-        {
-            set<float>(std::forward<K>(key), number);
-        }
-        
-        template<typename K>
-        void setDouble(K&& key, double number) const
-        {
-            set<double>(std::forward<K>(key), number);
-        }
     };
 
     template<>
@@ -372,7 +491,8 @@ namespace lua {
         return *this;
     }
 
-    inline bool operator!(const Value& rhs)
+    template<typename Derived>
+    inline bool operator!(const detail::ValueAccessors<Derived>& rhs)
     {
         return rhs.isNil();
     }
@@ -381,13 +501,12 @@ namespace lua {
         template<>
         struct ValueTraits<lua::Value>
         {
-            static inline int push(lua_State* luaState, lua::Value&& value) {
-                lua_pushvalue(luaState, value.getStackIndex());
-                return 1;
-            }
-
             static inline int push(lua_State* luaState, const lua::Value& value) {
-                lua_pushvalue(luaState, value.getStackIndex());
+                // Value can be on stack of other thread of same Lua state, for example on stack of lua::Coroutine
+                lua_State* valueState = value.getLuaState();
+                lua_pushvalue(valueState, value.getStackIndex());
+                if (valueState != luaState)
+                    lua_xmove(valueState, luaState, 1);
                 return 1;
             }
         };
@@ -0,0 +1,195 @@
+//
+//  StructTraits.h
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#pragma once
+
+#include "Traits.h"
+
+namespace lua {
+
+    namespace detail {
+
+        /// Unique address for each struct type, names of struct fields are stored under it in LUA_REGISTRYINDEX
+        template<typename T>
+        struct StructKey
+        {
+            static const char key;
+        };
+
+        template<typename T>
+        const char StructKey<T>::key = 0;
+    }
+}
+
+namespace lua { namespace traits {
+
+    //////////////////////////////////////////////////////////////////////////////////////////////
+    /// Conversion between C++ structs and Lua tables. Specialize ValueTraits for your struct, derive it from StructTraits
+    /// and list fields in static fields function:
+    ///
+    /// ~~~~~~~~~~~~~~~{.cpp}
+    /// namespace lua { namespace traits {
+    ///     template<>
+    ///     struct ValueTraits<Point> : StructTraits<Point>
+    ///     {
+    ///         template<typename Visitor>
+    ///         static void fields(Visitor& visitor)
+    ///         {
+    ///             visitor("x", &Point::x);
+    ///             visitor("y", &Point::y);
+    ///         }
+    ///     };
+    /// }}
+    /// ~~~~~~~~~~~~~~~
+    ///
+    /// Field names are interned only once per Lua state and kept in registry. Fields are accessed without metamethods,
+    /// each field can be any type with ValueTraits, also another struct or container.
+    ///
+    /// @note Struct must be default constructible, missing fields keep their default values
+    template<typename T>
+    struct StructTraits
+    {
+    private:
+
+        /// Collects field names to table on top of stack
+        struct NameCollector
+        {
+            lua_State* luaState;
+            lua::Integer count;
+
+            template<typename F>
+            void operator()(const char* name, F T::*)
+            {
+                lua_pushstring(luaState, name);
+                lua_rawseti(luaState, -2, ++count);
+            }
+        };
+
+        struct Reader
+        {
+            lua_State* luaState;
+            int table;
+            int names;
+            lua::Integer field;
+            T& object;
+
+            template<typename F>
+            void operator()(const char*, F T::* member)
+            {
+                lua_rawgeti(luaState, names, ++field);
+                lua_rawget(luaState, table);
+                if (!lua_isnil(luaState, -1))
+                    object.*member = ValueTraits<F>::read(luaState, -1);
+                lua_pop(luaState, 1);
+            }
+        };
+
+        struct Checker
+        {
+            lua_State* luaState;
+            int table;
+            int names;
+            lua::Integer field;
+            bool compatible;
+
+            template<typename F>
+            void operator()(const char*, F T::*)
+            {
+                lua_rawgeti(luaState, names, ++field);
+                lua_rawget(luaState, table);
+                if (compatible && !lua_isnil(luaState, -1))
+                    compatible = ValueTraits<F>::isCompatible(luaState, -1);
+                lua_pop(luaState, 1);
+            }
+        };
+
+        struct Writer
+        {
+            lua_State* luaState;
+            int table;
+            int names;
+            lua::Integer field;
+            const T& object;
+
+            template<typename F>
+            void operator()(const char*, F T::* member)
+            {
+                lua_rawgeti(luaState, names, ++field);
+                ValueTraits<F>::push(luaState, object.*member);
+                lua_rawset(luaState, table);
+            }
+        };
+
+        /// Pushes table with interned field names, it is created when it is needed first time
+        ///
+        /// @return Index of table with field names
+        static int pushNames(lua_State* luaState)
+        {
+            luaL_checkstack(luaState, 3, nullptr);
+
+            lua_rawgetp(luaState, LUA_REGISTRYINDEX, &lua::detail::StructKey<T>::key);
+            if (lua_isnil(luaState, -1))
+            {
+                lua_pop(luaState, 1);
+                lua_newtable(luaState);
+
+                NameCollector collector{ luaState, 0 };
+                ValueTraits<T>::fields(collector);
+
+                lua_pushvalue(luaState, -1);
+                lua_rawsetp(luaState, LUA_REGISTRYINDEX, &lua::detail::StructKey<T>::key);
+            }
+            return lua_gettop(luaState);
+        }
+
+    public:
+
+        static inline T read(lua_State* luaState, int index)
+        {
+            T object{};
+            if (!lua_istable(luaState, index))
+                return object;
+
+            index = lua_absindex(luaState, index);
+            int names = pushNames(luaState);
+
+            Reader reader{ luaState, index, names, 0, object };
+            ValueTraits<T>::fields(reader);
+
+            lua_pop(luaState, 1);
+            return object;
+        }
+
+        /// Checks table and types of its fields, missing fields are allowed
+        static inline bool isCompatible(lua_State* luaState, int index)
+        {
+            if (!lua_istable(luaState, index))
+                return false;
+
+            index = lua_absindex(luaState, index);
+            int names = pushNames(luaState);
+
+            Checker checker{ luaState, index, names, 0, true };
+            ValueTraits<T>::fields(checker);
+
+            lua_pop(luaState, 1);
+            return checker.compatible;
+        }
+
+        static inline int push(lua_State* luaState, const T& object)
+        {
+            int names = pushNames(luaState);
+            lua_createtable(luaState, 0, static_cast<int>(lua_rawlen(luaState, names)));
+
+            Writer writer{ luaState, names + 1, names, 0, object };
+            ValueTraits<T>::fields(writer);
+
+            // Remove names, so only created table stays in stack
+            lua_remove(luaState, names);
+            return 1;
+        }
+    };
+}}
@@ -14,6 +14,16 @@
 #include <cmath>
 #include <limits>
 #include <string>
+#include <tuple>
+
+#ifdef LUASTATE_CXX17
+#include <string_view>
+#endif
+
+#ifdef LUASTATE_CXX20
+#include <cstddef>
+#include <span>
+#endif
 
 namespace lua { namespace traits {
     
@@ -63,7 +73,8 @@ namespace lua { namespace traits {
     template<typename T>
     using RemoveCVR = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
 
-    template<typename T>
+    /// Conversion of C++ type to Lua values and back. Enable parameter allows partial specializations for groups of types.
+    template<typename T, typename Enable = void>
     struct ValueTraits;
 
     template<typename T>
@@ -303,10 +314,11 @@ namespace lua { namespace traits {
     template<>
     struct ValueTraits<std::string>
     {
-        static inline std::string read(lua_State* luaState, int index) noexcept
+        static inline std::string read(lua_State* luaState, int index)
         {
-            lua::String str = lua_tostring(luaState, index);
-            return str==nullptr ? std::string() : str;
+            std::size_t length = 0;
+            lua::String str = lua_tolstring(luaState, index, &length);
+            return str==nullptr ? std::string() : std::string(str, length);
         }
 
         static inline bool isCompatible(lua_State* luaState, int index) noexcept
@@ -320,22 +332,80 @@ namespace lua { namespace traits {
 
         static inline void get(lua_State* luaState, int index, const std::string& key) noexcept
         {
-            lua_getfield(luaState, index, key.c_str());
+            // Key can contain zeros, so we can't use lua_getfield
+            index = lua_absindex(luaState, index);
+            lua_pushlstring(luaState, key.data(), key.length());
+            lua_gettable(luaState, index);
         }
 
         static inline int push(lua_State* luaState, const std::string& value) noexcept
         {
-            lua_pushstring(luaState, value.c_str());
+            lua_pushlstring(luaState, value.data(), value.length());
             return 1;
         }
 
         static inline int push(lua_State* luaState, const std::string& value, std::size_t length) noexcept
         {
-            lua_pushlstring(luaState, value.substr(0, length).c_str(), std::min(length, value.length()));
+            lua_pushlstring(luaState, value.data(), std::min(length, value.length()));
             return 1;
         }
     };
 
+    /// Traits for views of Lua strings. Read views are pointing to memory of Lua string, so they are valid only while
+    /// string is referenced from Lua state. Strings are read with their length, so they can contain zeros.
+    template<typename View, typename Char>
+    struct StringViewTraits
+    {
+        static inline View read(lua_State* luaState, int index) noexcept
+        {
+            std::size_t length = 0;
+            lua::String str = lua_tolstring(luaState, index, &length);
+            return str==nullptr ? View() : View(reinterpret_cast<const Char*>(str), length);
+        }
+
+        static inline bool isCompatible(lua_State* luaState, int index) noexcept
+        {
+            return lua_type(luaState, index) == LUA_TSTRING;
+        }
+
+        static inline void get(lua_State* luaState, int index, View key) noexcept
+        {
+            index = lua_absindex(luaState, index);
+            push(luaState, key);
+            lua_gettable(luaState, index);
+        }
+
+        static inline int push(lua_State* luaState, View value) noexcept
+        {
+            lua_pushlstring(luaState, reinterpret_cast<lua::String>(value.data()), value.size());
+            return 1;
+        }
+    };
+
+#ifdef LUASTATE_CXX17
+    template<>
+    struct ValueTraits<std::string_view> : StringViewTraits<std::string_view, char>
+    {
+    };
+#endif
+
+#ifdef LUASTATE_CXX20
+    template<>
+    struct ValueTraits<std::span<const char>> : StringViewTraits<std::span<const char>, char>
+    {
+    };
+
+    template<>
+    struct ValueTraits<std::span<const unsigned char>> : StringViewTraits<std::span<const unsigned char>, unsigned char>
+    {
+    };
+
+    template<>
+    struct ValueTraits<std::span<const std::byte>> : StringViewTraits<std::span<const std::byte>, std::byte>
+    {
+    };
+#endif
+
     template<std::size_t N>
     struct ValueTraits<const char[N]> : ValueTraits<lua::String>
     {
@@ -404,9 +474,9 @@ namespace lua { namespace traits {
             lua_gettable(luaState, index);
         }
 
-        static inline int push(lua_State* luaState, lua::Table) noexcept
+        static inline int push(lua_State* luaState, lua::Table table) noexcept
         {
-            lua_newtable(luaState);
+            lua_createtable(luaState, table.arraySize, table.hashSize);
             return 1;
         }
     };
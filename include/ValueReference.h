@@ -18,6 +18,7 @@ namespace lua {
         /// Pointer of Lua state
         lua_State* m_luaState = nullptr;
         detail::DeallocQueue* m_deallocQueue = nullptr;
+        detail::StackItemPool* m_stackItemPool = nullptr;
         
         /// Key of referenced value in LUA_REGISTRYINDEX
         int m_refKey;
@@ -52,6 +53,7 @@ namespace lua {
         {
             m_luaState = value.m_stack->state;
             m_deallocQueue = value.m_stack->deallocQueue;
+            m_stackItemPool = value.m_stack->pool;
 
             // Duplicate top value
             lua_pushvalue(m_luaState, -1);
@@ -65,6 +67,7 @@ namespace lua {
         {
             m_luaState = value.m_stack->state;
             m_deallocQueue = value.m_stack->deallocQueue;
+            m_stackItemPool = value.m_stack->pool;
             
             if (value.m_stack->pushed > 0)
                 value.m_stack->pushed -= 1;
@@ -81,7 +84,7 @@ namespace lua {
         Value unref() const
         {
             lua_rawgeti(m_luaState, LUA_REGISTRYINDEX, m_refKey);
-            return Value(std::make_shared<detail::StackItem>(m_luaState, m_deallocQueue, lua_gettop(m_luaState) - 1, 1, 0));
+            return Value(detail::makeStackItem(m_stackItemPool, m_luaState, m_deallocQueue, lua_gettop(m_luaState) - 1, 1, 0));
         }
         
         bool isInitialized() const
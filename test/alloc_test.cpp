@@ -0,0 +1,107 @@
+//
+//  alloc_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+
+#include <cstdlib>
+#include <new>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static std::size_t cppAllocations = 0;
+
+void* operator new(std::size_t size)
+{
+    ++cppAllocations;
+    void* memory = std::malloc(size);
+    if (memory == nullptr)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    lua::PoolAllocator* allocator = new lua::PoolAllocator();
+    lua::State state{ std::unique_ptr<lua::BaseAllocator>(allocator) };
+    assert(state.getAllocator() == allocator);
+
+    const lua::PoolAllocator::Statistics& statistics = allocator->getStatistics();
+    assert(statistics.liveBytes > 0);
+    assert(statistics.peakBytes >= statistics.liveBytes);
+
+    state.doString(createVariables);
+    state.doString(createFunctions);
+    assert(state["table"]["a"].toCStr()[0] == 'a');
+    assert(state["getValues"]().toInt() == 1);
+
+    // Churn small objects and one big table
+    state.doString("for i = 1, 10000 do local t = { i, tostring(i) } end");
+    state.doString("big = {} for i = 1, 10000 do big[i] = i end");
+    assert(state["big"][10000].toInt() == 10000);
+
+    std::size_t pooled = 0;
+    for (std::size_t i = 0; i < lua::PoolAllocator::SizeClasses; ++i)
+        pooled += statistics.allocations[i];
+    assert(pooled > 10000);
+    assert(statistics.allocations[lua::PoolAllocator::SizeClasses] > 0);
+
+    // Freed memory is returned to allocator
+    std::size_t peak = statistics.peakBytes;
+    state.doString("big = nil collectgarbage()");
+    assert(statistics.liveBytes < peak);
+
+    // Stack items of lua::Value instances are reused, so table lookups don't allocate
+    state.doString("deep = { a = { b = { c = 42 } } }");
+    assert(state["deep"]["a"]["b"]["c"].toInt() == 42);
+    std::size_t allocations = cppAllocations;
+    for (int i = 0; i < 100; ++i)
+        assert(state["deep"]["a"]["b"]["c"].toInt() == 42);
+    assert(cppAllocations == allocations);
+    
+    state.checkMemLeaks();
+    
+    // Memory limit
+    lua::State limited;
+    assert(limited.getMemoryLimit() == 0);
+    assert(limited.getMemoryUsage() > 0);
+    
+    limited.setMemoryLimit(limited.getMemoryUsage() + 256 * 1024);
+    limited.doString("small = {} for i = 1, 100 do small[i] = i end");
+    
+    bool thrown = false;
+    try {
+        limited.doString("huge = {} for i = 1, 1e7 do huge[i] = i end");
+    } catch (lua::MemoryLimitError& ex) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(limited.getMemoryUsage() <= limited.getMemoryLimit());
+    
+    thrown = false;
+    limited.doString("huge = nil; collectgarbage()");
+    limited.doString("function hog() local t = {} for i = 1, 1e7 do t[i] = tostring(i) end end");
+    try {
+        limited["hog"].call();
+    } catch (lua::RuntimeError& ex) {
+        thrown = dynamic_cast<lua::MemoryLimitError*>(&ex) != nullptr;
+    }
+    assert(thrown);
+    
+    // State is still usable after reaching limit
+    limited.doString("collectgarbage()");
+    assert(limited.doString("return #small").toInt() == 100);
+    
+    limited.setMemoryLimit(0);
+    limited.doString("huge = {} for i = 1, 1e5 do huge[i] = i end");
+    
+    limited.checkMemLeaks();
+    return 0;
+}
@@ -0,0 +1,181 @@
+//
+//  async_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+#include "../include/LuaAsync.h"
+
+#if defined(LUASTATE_CXX20) && LUA_VERSION_NUM >= 503
+
+#include <stdexcept>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+struct Client
+{
+    lua::EventLoop* loop;
+
+    explicit Client(lua::EventLoop* loop) : loop(loop) {}
+
+    lua::Task<int> fetch(int id)
+    {
+        co_await loop->sleep(std::chrono::milliseconds(1));
+        co_return id * 100;
+    }
+
+    lua::Task<int> reject(int id)
+    {
+        throw std::runtime_error("rejected " + std::to_string(id));
+        co_return id;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static const char* createScripts = R"(
+
+results = {}
+order = {}
+
+function request(id, delay)
+    local value = fetch(id, delay)
+    order[#order + 1] = id
+    results[id] = value
+end
+
+function protected()
+    local ok, message = pcall(failing)
+    results.protected = not ok and message
+end
+
+function cooperative(name)
+    for i = 1, 3 do
+        order[#order + 1] = name .. i
+        coroutine.yield()
+    end
+end
+
+function chained(id)
+    sleep(1)
+    results.chained = twice(fetch(id, 1))
+end
+
+function methods(id)
+    results.method = client:fetch(id)
+    local ok, message = pcall(client.reject, client, id)
+    results.rejected = not ok and message
+end
+
+)";
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    using namespace std::chrono;
+
+    lua::State state;
+    lua::EventLoop loop(state);
+    state.doString(createScripts);
+
+    state.set("sleep", [&loop](int milliseconds) -> lua::Task<> {
+        co_await loop.sleep(std::chrono::milliseconds(milliseconds));
+    });
+    state.set("fetch", [&loop](int id, int milliseconds) -> lua::Task<int> {
+        co_await loop.sleep(std::chrono::milliseconds(milliseconds));
+        co_return id * 10;
+    });
+    state.set("twice", [](int value) -> lua::Task<int> {
+        co_return value * 2;
+    });
+    state.set("failing", [&loop]() -> lua::Task<int> {
+        co_await loop.sleep(std::chrono::milliseconds(1));
+        throw std::runtime_error("fetch failed");
+    });
+
+    {   // Waits of many scripts overlap
+        const int Count = 50;
+        auto start = steady_clock::now();
+        for (int id = 1; id <= Count; ++id)
+            loop.spawn(state["request"], id, 20 + (Count - id) % 5);
+        assert(loop.getScriptCount() == Count);
+
+        loop.run();
+        auto elapsed = steady_clock::now() - start;
+        assert(elapsed >= milliseconds(20));
+        assert(elapsed < milliseconds(20 * Count / 2));
+        assert(loop.getScriptCount() == 0);
+
+        for (int id = 1; id <= Count; ++id)
+            assert(state["results"][id].toInt() == id * 10);
+
+        // Scripts with shorter waits finished first
+        assert(state["order"][1].toInt() % 5 == Count % 5);
+    }
+
+    {   // Task finished synchronously doesn't suspend script, tasks can be chained
+        loop.spawn(state["chained"], 4);
+        loop.run();
+        assert(state["results"]["chained"].toInt() == 80);
+    }
+
+    {   // Exceptions of tasks are Lua errors
+        loop.spawn(state["protected"]);
+        loop.run();
+        assert(std::string(state["results"]["protected"].toString()).find("fetch failed") != std::string::npos);
+
+        loop.spawn(state["failing"]);
+        bool thrown = false;
+        try {
+            loop.run();
+        } catch (lua::RuntimeError& ex) {
+            thrown = strstr(ex.what(), "fetch failed") != nullptr;
+        }
+        assert(thrown);
+        assert(loop.getScriptCount() == 0);
+    }
+
+    {   // Methods of bound classes suspend script and raise errors like bound functions
+        state.defineClass<Client>("Client")
+            .method("fetch", &Client::fetch)
+            .method("reject", &Client::reject);
+        lua::Class<Client>::push(state.getState(), &loop);
+        lua_setglobal(state.getState(), "client");
+
+        loop.spawn(state["methods"], 3);
+        loop.run();
+        assert(state["results"]["method"].toInt() == 300);
+        assert(std::string(state["results"]["rejected"].toString()).find("rejected 3") != std::string::npos);
+        assert(lua_gettop(state.getState()) == 0);
+    }
+
+    {   // Scripts which yield are resumed in turns
+        state.doString("order = {}");
+        loop.spawn(state["cooperative"], "a");
+        loop.spawn(state["cooperative"], "b");
+        loop.run();
+        assert(state.doString("return table.concat(order, ' ')").toString() == std::string("a1 b1 a2 b2 a3 b3"));
+    }
+
+    {   // Asynchronous functions can't be called outside of event loop
+        bool thrown = false;
+        try {
+            state.doString("sleep(1)");
+        } catch (lua::RuntimeError& ex) {
+            thrown = strstr(ex.what(), "lua::EventLoop") != nullptr;
+        }
+        assert(thrown);
+    }
+
+    state.checkMemLeaks();
+    return 0;
+}
+
+#else
+
+int main(int argc, char** argv)
+{
+    // Asynchronous functions require C++20 and Lua 5.3 or newer
+    return 0;
+}
+
+#endif
@@ -0,0 +1,177 @@
+//
+//  budget_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+#include "../include/LuaCoroutine.h"
+
+#include <chrono>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static bool exceeds(lua::State& state, const std::string& code, lua::ExecutionLimitError::Limit limit)
+{
+    try {
+        state.doString(code);
+    } catch (lua::ExecutionLimitError& ex) {
+        return ex.getLimit() == limit;
+    }
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    using namespace std::chrono;
+    using Limit = lua::ExecutionLimitError::Limit;
+
+    lua::State state;
+    state.doString("function spin() while true do end end\n"
+                   "function count(n) local sum = 0; for i = 1, n do sum = sum + i end; return sum end\n"
+                   "function stubborn() while true do pcall(spin) end end");
+
+    {   // Calls without budget don't have hook
+        assert(lua_gethook(state.getState()) == nullptr);
+        assert(state["count"].call(100000).toInt() == 5000050000LL);
+        assert(!state.getExecutionBudget().isLimited());
+    }
+
+    {   // Budget of state limits each call separately
+        state.setExecutionBudget(lua::ExecutionBudget(100000));
+        assert(lua_gethook(state.getState()) != nullptr);
+
+        // Setting budget doesn't limit unprotected calls made before first protected one
+        assert(state["count"](1000000).toInt() == 500000500000LL);
+
+        assert(state["count"].call(1000).toInt() == 500500);
+        assert(state["count"].call(1000).toInt() == 500500);
+        assert(exceeds(state, "spin()", Limit::Instructions));
+        assert(exceeds(state, "count(1000000)", Limit::Instructions));
+
+        // Script can't catch exceeded budget
+        assert(exceeds(state, "stubborn()", Limit::Instructions));
+
+        // Exceeded budget is also lua::RuntimeError and it doesn't affect next calls
+        bool thrown = false;
+        try {
+            state["spin"].call();
+        } catch (lua::RuntimeError& ex) {
+            thrown = strstr(ex.what(), "instruction limit") != nullptr;
+        }
+        assert(thrown);
+        assert(state["count"].call(10).toInt() == 55);
+
+        lua::Chunk chunk = state.compile("spin()");
+        thrown = false;
+        try {
+            chunk.call();
+        } catch (lua::ExecutionLimitError& ex) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        // Unprotected calls outside of protected ones aren't limited
+        assert(state["count"](1000000).toInt() == 500000500000LL);
+
+        state.setExecutionBudget(lua::ExecutionBudget());
+        assert(lua_gethook(state.getState()) == nullptr);
+    }
+
+    {   // Deadline uses monotonic clock
+        state.setExecutionBudget(lua::ExecutionBudget(0, milliseconds(20)));
+        auto start = steady_clock::now();
+        assert(exceeds(state, "spin()", Limit::Deadline));
+        auto elapsed = steady_clock::now() - start;
+        assert(elapsed >= milliseconds(20) && elapsed < seconds(2));
+        state.setExecutionBudget(lua::ExecutionBudget());
+    }
+
+    {   // Nested calls from bound functions share budget of outermost call
+        state.set("callback", [&state](int n) { return state["count"].call(n).toInt(); });
+        state.setExecutionBudget(lua::ExecutionBudget(50000));
+        assert(state.doString("return callback(100)").toInt() == 5050);
+        assert(state.doString("for i = 1, 40000 do end; return true").toBool());
+        assert(exceeds(state, "callback(5000); callback(5000); for i = 1, 40000 do end", Limit::Instructions));
+        state.setExecutionBudget(lua::ExecutionBudget());
+    }
+
+    {   // Guard limits all calls while it exists and it takes precedence over budget of state
+        state.setExecutionBudget(lua::ExecutionBudget(1000000));
+        {
+            lua::BudgetGuard guard(state.getState(), lua::ExecutionBudget(30000));
+            assert(state["count"].call(1000).toInt() == 500500);
+            assert(state["count"].call(1000).toInt() == 500500);
+            assert(exceeds(state, "count(100000)", Limit::Instructions));
+        }
+        assert(state["count"].call(10000).toInt() == 50005000);
+        state.setExecutionBudget(lua::ExecutionBudget());
+
+        {
+            lua::BudgetGuard guard(state.getState(), lua::ExecutionBudget(0, milliseconds(10)));
+            assert(exceeds(state, "spin()", Limit::Deadline));
+        }
+        assert(lua_gethook(state.getState()) == nullptr);
+
+        // Unprotected calls under guard aren't interrupted, but they use its budget
+        {
+            lua::BudgetGuard guard(state.getState(), lua::ExecutionBudget(1000));
+            assert(state["count"](100000).toInt() == 5000050000LL);
+            assert(exceeds(state, "count(10)", Limit::Instructions));
+        }
+        assert(lua_gethook(state.getState()) == nullptr);
+    }
+
+    {   // Each resume of coroutine has budget of state
+        state.setExecutionBudget(lua::ExecutionBudget(100000));
+        lua::Coroutine spinning(state["spin"]);
+        bool thrown = false;
+        try {
+            spinning.resume();
+        } catch (lua::ExecutionLimitError& ex) {
+            thrown = ex.getLimit() == Limit::Instructions;
+        }
+        assert(thrown);
+        assert(spinning.getStatus() == lua::Coroutine::Status::Failed);
+
+        state.doString("function counting(n) while true do n = coroutine.yield(count(n)) end end");
+        lua::Coroutine counting(state["counting"]);
+        assert(lua_gethook(counting.getThread()) != nullptr);
+        assert(counting.resume(1000).toInt() == 500500);
+        assert(counting.resume(1000).toInt() == 500500);
+
+        // Coroutine created while hook was installed doesn't keep it after budget is removed
+        state.setExecutionBudget(lua::ExecutionBudget());
+        assert(counting.resume(1000000).toInt() == 500000500000LL);
+        assert(lua_gethook(counting.getThread()) == nullptr);
+    }
+
+    {   // Coroutines resumed by scripts are limited, also when they were created before first budget
+        lua::State fresh;
+        fresh.doString("co = coroutine.create(function() local sum = 0; for i = 1, 10000000 do sum = sum + i end; return sum end)");
+        fresh.setExecutionBudget(lua::ExecutionBudget(100000));
+        assert(exceeds(fresh, "coroutine.resume(co)", Limit::Instructions));
+
+        fresh.setExecutionBudget(lua::ExecutionBudget(0, milliseconds(10)));
+        fresh.doString("co = coroutine.create(function() while true do end end)");
+        assert(exceeds(fresh, "coroutine.resume(co)", Limit::Deadline));
+
+        // Coroutine created by unprotected call outside of protected ones
+        fresh.doString("function create() co = coroutine.create(function() while true do end end) end");
+        fresh["create"]();
+        assert(exceeds(fresh, "coroutine.resume(co)", Limit::Deadline));
+        fresh.setExecutionBudget(lua::ExecutionBudget());
+
+        // Coroutine which inherited other hook count gets count of thread which resumes it
+        fresh.startProfiler(10);
+        fresh.doString("co = coroutine.create(function() for i = 1, 2000 do end; return 'done' end)");
+        fresh.stopProfiler();
+        fresh.setExecutionBudget(lua::ExecutionBudget(100000));
+        assert(fresh.doString("local ok, result = coroutine.resume(co); return result").toString() == std::string("done"));
+        fresh.setExecutionBudget(lua::ExecutionBudget());
+        fresh.checkMemLeaks();
+    }
+
+    state.checkMemLeaks();
+    return 0;
+}
@@ -0,0 +1,127 @@
+//
+//  channel_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+#include "../include/LuaChannel.h"
+
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    lua::State producer;
+    lua::State consumer;
+    lua::Channel channel(3);
+    assert(channel.capacity() == 4);
+
+    {   // Values keep their types
+        producer.doString("message = { 1, 2.5, 'three', true, name = 'test\\0binary', nested = { -7, [10] = false } }");
+        assert(channel.send(producer["message"]));
+        assert(channel.send(producer["message"]["name"]));
+
+        lua::Value value;
+        assert(channel.receive(consumer, value));
+        assert(value.is<lua::Table>());
+        assert(value[1].toInt() == 1);
+        assert(value[2].toNumber() == 2.5);
+        assert(value[3].toString() == "three");
+        assert(value[4].toBool() == true);
+        assert(value["name"].toString() == std::string("test\0binary", 11));
+        assert(value["nested"][1].toInt() == -7);
+        assert(value["nested"][10].is<lua::Boolean>());
+        assert(value.length() == 4);
+
+        assert(channel.receive(consumer, value));
+        assert(value.toString() == std::string("test\0binary", 11));
+
+        assert(!channel.receive(consumer, value));
+    }
+
+    {   // Full channel refuses values
+        producer.doString("small = 1");
+        for (int i = 0; i < 4; ++i)
+            assert(channel.send(producer["small"]));
+        assert(!channel.send(producer["small"]));
+        assert(channel.receiveBatch(consumer, [](const lua::Value& value) { assert(value.toInt() == 1); }) == 4);
+    }
+
+    {   // Batches take one slot and are received one by one
+        producer.doString("a = 1; b = 'two'; c = { 3 }");
+        std::vector<lua::Value> values = { producer["a"], producer["b"], producer["c"] };
+        assert(channel.sendBatch(values.begin(), values.end()));
+        values.clear();
+
+        std::vector<std::string> received;
+        std::size_t count = channel.receiveBatch(consumer, [&](const lua::Value& value) {
+            received.push_back(value.is<lua::Table>() ? "table" : value.toString());
+        }, 2);
+        assert(count == 2);
+        assert(received.size() == 2 && received[0] == "1" && received[1] == "two");
+
+        lua::Value value;
+        assert(channel.receive(consumer, value));
+        assert(value[1].toInt() == 3);
+    }
+
+    {   // Functions can't be sent
+        bool thrown = false;
+        try {
+            channel.send(producer["print"]);
+        } catch (lua::SerializationError& ex) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    {   // Cyclic tables keep their identity
+        producer.doString("cyclic = {}; cyclic.self = cyclic");
+        assert(channel.send(producer["cyclic"]));
+
+        lua::Value value;
+        assert(channel.receive(consumer, value));
+        consumer.set("received", value);
+        assert(consumer.doString("return received.self == received and received.self.self == received").toBool());
+    }
+
+    {   // Many producer threads with their own states
+        lua::Channel shared(64);
+        const int Producers = 4;
+        const int Messages = 1000;
+
+        std::vector<std::thread> threads;
+        for (int id = 0; id < Producers; ++id)
+        {
+            threads.emplace_back([&shared, id]() {
+                lua::State state;
+                for (int i = 0; i < Messages; ++i)
+                {
+                    lua::Value message = state.doString("return { producer = " + std::to_string(id) + ", index = " + std::to_string(i) + " }");
+                    while (!shared.send(message))
+                        std::this_thread::yield();
+                }
+            });
+        }
+
+        std::vector<int> nextIndex(Producers, 0);
+        int received = 0;
+        while (received < Producers * Messages)
+        {
+            received += static_cast<int>(shared.receiveBatch(consumer, [&](const lua::Value& value) {
+                int id = value["producer"].toInt();
+                assert(value["index"].toInt() == nextIndex[id]);
+                ++nextIndex[id];
+            }));
+        }
+
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    producer.checkMemLeaks();
+    consumer.checkMemLeaks();
+    return 0;
+}
@@ -0,0 +1,130 @@
+//
+//  class_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static int liveVectors = 0;
+
+struct Vector
+{
+    double x = 0;
+    double y = 0;
+    std::string name;
+    
+    Vector() { ++liveVectors; }
+    Vector(double x, double y) : x(x), y(y) { ++liveVectors; }
+    Vector(const Vector& other) : x(other.x), y(other.y), name(other.name) { ++liveVectors; }
+    ~Vector() { --liveVectors; }
+    
+    double length() const { return std::sqrt(x * x + y * y); }
+    void scale(double factor) { x *= factor; y *= factor; }
+    void rename(const std::string& newName) { name = newName; }
+    const std::string& getName() const { return name; }
+    
+    static Vector zero() { return Vector(); }
+};
+
+struct Counter
+{
+    int count = 0;
+    void increment() { ++count; }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    {
+        lua::State state;
+        state.defineClass<Vector>("Vector")
+            .constructor<double, double>()
+            .method("length", &Vector::length)
+            .method("scale", &Vector::scale)
+            .method("rename", &Vector::rename)
+            .method("getName", &Vector::getName)
+            .property("x", &Vector::x)
+            .property("y", &Vector::y)
+            .property("name", &Vector::name)
+            .function("count", std::function<int()>([]() { return liveVectors; }));
+        
+        // Methods and properties
+        state.doString("v = Vector.new(3, 4)");
+        assert(liveVectors == 1);
+        assert(state.doString("return v:length()").toNumber() == 5);
+        state.doString("v:scale(2); assert(v.x == 6 and v.y == 8)");
+        state.doString("v.x = 0; assert(v:length() == 8)");
+        state.doString("v:rename('velocity'); assert(v:getName() == 'velocity' and v.name == 'velocity')");
+        state.doString("assert(v.missing == nil)");
+        assert(state.doString("return Vector.count()").toInt() == 1);
+        
+        // Objects are stored in userdata
+        Vector* vector = state["v"].toPtr<Vector>();
+        assert(vector->y == 8 && vector->name == "velocity");
+        assert(lua::Class<Vector>::toObject(state.getState(), -1) == nullptr);
+        
+        // Errors
+        try {
+            state.doString("v.unknown = 1");
+            assert(false);
+        } catch (lua::RuntimeError ex) {
+            printf("%s\n", ex.what());
+        }
+        try {
+            state.doString("v.length({})");
+            assert(false);
+        } catch (lua::RuntimeError ex) {
+            printf("%s\n", ex.what());
+        }
+        state.doString("assert(getmetatable(v) == 'Vector')");
+        
+        // Objects pushed from C++
+        lua::Class<Vector>::push(state.getState(), 1.0, 0.0);
+        lua_setglobal(state.getState(), "unit");
+        state.doString("assert(unit:length() == 1)");
+        
+        // Second class has its own metatable
+        state.defineClass<Counter>("Counter")
+            .constructor<>()
+            .method("increment", &Counter::increment)
+            .property("count", &Counter::count);
+        state.doString("c = Counter.new(); c:increment(); c:increment(); assert(c.count == 2)");
+        state.doString("assert(c.x == nil and v.count == nil)");
+        try {
+            state.doString("c.increment(v)");
+            assert(false);
+        } catch (lua::RuntimeError ex) {
+            printf("%s\n", ex.what());
+        }
+
+        // Metamethods of one class don't access objects of other class
+        state.doString("assert(debug.getmetatable(v).__index(c, 'x') == nil)");
+        try {
+            state.doString("debug.getmetatable(v).__newindex(c, 'x', 1)");
+            assert(false);
+        } catch (lua::RuntimeError ex) {
+            printf("%s\n", ex.what());
+        }
+
+        // Bound functions take objects as pointers
+        state.set("lengthOf", [](const Vector* vector) { return vector != nullptr ? vector->length() : -1.0; });
+        assert(state.doString("return lengthOf(v)").toNumber() == 8);
+        assert(state.doString("return lengthOf(c)").toNumber() == -1);
+        assert(state.doString("return lengthOf(1)").toNumber() == -1);
+
+        // Destructors are called by garbage collector
+        state.doString("for i = 1, 100 do local t = Vector.new(i, i) end");
+        state.doString("v = nil; unit = nil; collectgarbage(); collectgarbage()");
+        assert(liveVectors == 0);
+        
+        state.doString("v = Vector.new(1, 1)");
+        assert(liveVectors == 1);
+        state.checkMemLeaks();
+    }
+    
+    // Closing state destroys remaining objects
+    assert(liveVectors == 0);
+    return 0;
+}
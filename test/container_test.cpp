@@ -0,0 +1,95 @@
+//
+//  container_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    lua::State state;
+    state.doString("numbers = { 1.5, 2.5, 3.5 }");
+    state.doString("names = { 'a', 'b', 'c' }");
+    state.doString("ages = { alice = 30, bob = 25 }");
+    state.doString("squares = { [1] = 1, [2] = 4, [3] = 9 }");
+    
+    // Reading
+    std::vector<double> numbers = state["numbers"].to<std::vector<double>>();
+    assert(numbers.size() == 3);
+    assert(numbers[0] == 1.5 && numbers[2] == 3.5);
+    assert(state["numbers"].is<std::vector<double>>());
+    assert(!state["names"].is<std::vector<double>>());
+    assert(state["names"].is<std::vector<std::string>>());
+    assert(state["names"].to<std::vector<std::string>>()[1] == "b");
+    
+    std::array<int, 3> squares = state["squares"].to<std::array<int, 3>>();
+    assert(squares[0] == 1 && squares[1] == 4 && squares[2] == 9);
+    assert((!state["squares"].is<std::array<int, 2>>()));
+    
+    std::map<std::string, int> ages = state["ages"].to<std::map<std::string, int>>();
+    assert(ages.size() == 2 && ages["alice"] == 30 && ages["bob"] == 25);
+    assert((state["ages"].is<std::unordered_map<std::string, int>>()));
+    assert((!state["ages"].is<std::map<int, int>>()));
+    
+    std::unordered_map<int, int> squareMap = state["squares"].to<std::unordered_map<int, int>>();
+    assert(squareMap.size() == 3 && squareMap[3] == 9);
+    
+    // Keys which are numbers are read as strings without breaking traversal
+    state.doString("mixed = { 10, 20, x = 30 }");
+    std::map<std::string, int> mixed = state["mixed"].to<std::map<std::string, int>>();
+    assert(mixed.size() == 3 && mixed["1"] == 10 && mixed["x"] == 30);
+    
+    // Not a table
+    assert(state["nothing"].to<std::vector<int>>().empty());
+    assert(!state["nothing"].is<std::vector<int>>());
+    
+    // Nested containers
+    state.doString("matrix = { { 1, 2 }, { 3, 4 } }");
+    std::vector<std::vector<int>> matrix = state["matrix"].to<std::vector<std::vector<int>>>();
+    assert(matrix.size() == 2 && matrix[1][0] == 3);
+    
+    // Pushing
+    state.set("pushed", std::vector<int>{ 5, 6, 7 });
+    state.doString("assert(#pushed == 3 and pushed[1] == 5 and pushed[3] == 7)");
+    
+    std::array<std::string, 2> pair = {{ "x", "y" }};
+    state.set("pushedArray", pair);
+    state.doString("assert(#pushedArray == 2 and pushedArray[2] == 'y')");
+    
+    std::map<std::string, double> prices = { { "apple", 1.5 }, { "pear", 2.0 } };
+    state.set("prices", prices);
+    state.doString("assert(prices.apple == 1.5 and prices.pear == 2.0)");
+    
+    state["prices"].set("list", std::vector<std::string>{ "apple", "pear" });
+    state.doString("assert(prices.list[2] == 'pear')");
+    
+    // Bound functions
+    state.set("sum", std::function<double(std::vector<double>)>([](std::vector<double> values) -> double {
+        double sum = 0;
+        for (double value : values)
+            sum += value;
+        return sum;
+    }));
+    state.doString("assert(sum({ 1, 2, 3.5 }) == 6.5)");
+    
+    state.set("range", std::function<std::vector<int>(int)>([](int count) -> std::vector<int> {
+        std::vector<int> values;
+        for (int i = 1; i <= count; ++i)
+            values.push_back(i);
+        return values;
+    }));
+    state.doString("local r = range(4); assert(#r == 4 and r[4] == 4)");
+    
+    state.set("invert", std::function<std::unordered_map<int, std::string>(std::map<std::string, int>)>([](std::map<std::string, int> values) {
+        std::unordered_map<int, std::string> inverted;
+        for (const auto& pair : values)
+            inverted[pair.second] = pair.first;
+        return inverted;
+    }));
+    state.doString("local i = invert({ a = 1, b = 2 }); assert(i[1] == 'a' and i[2] == 'b')");
+    
+    state.checkMemLeaks();
+    return 0;
+}
@@ -0,0 +1,141 @@
+//
+//  coroutine_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+#include "../include/LuaCoroutine.h"
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static const char* createCoroutines = R"(
+
+function squares(count)
+    for i = 1, count do
+        coroutine.yield(i, i * i)
+    end
+    return 'done'
+end
+
+function accumulate(value)
+    local sum = 0
+    while value do
+        sum = sum + value
+        value = coroutine.yield(sum)
+    end
+    return sum
+end
+
+function failing()
+    coroutine.yield()
+    error('session failed')
+end
+
+function session(id)
+    local request = coroutine.yield('ready')
+    return { id = id, request = request }
+end
+
+)";
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    lua::State state;
+    state.doString(createCoroutines);
+
+    {   // Yielded values are returned from resume
+        lua::Coroutine coroutine(state["squares"]);
+        assert(coroutine.isResumable());
+
+        int index = 0, square = 0;
+        lua::tie(index, square) = coroutine.resume(3);
+        assert(index == 1 && square == 1);
+
+        lua::tie(index, square) = coroutine.resume();
+        assert(index == 2 && square == 4);
+
+        lua::Value value = coroutine.resume();
+        assert(value.toInt() == 3);
+        assert(coroutine.getStatus() == lua::Coroutine::Status::Suspended);
+
+        // Previous value is replaced after next resume is finished
+        value = coroutine.resume();
+        assert(value.toString() == std::string("done"));
+        assert(coroutine.getStatus() == lua::Coroutine::Status::Finished);
+        assert(!coroutine.isResumable());
+
+        bool thrown = false;
+        try {
+            coroutine.resume();
+        } catch (lua::RuntimeError& ex) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    {   // Arguments of resume are results of yield
+        lua::Coroutine coroutine(state["accumulate"]);
+        assert(coroutine.resume(1).toInt() == 1);
+        assert(coroutine.resume(2).toInt() == 3);
+        assert(coroutine.resume(3.5).toNumber() == 6.5);
+        assert(coroutine.resume().toNumber() == 6.5);
+        assert(coroutine.getStatus() == lua::Coroutine::Status::Finished);
+    }
+
+    {   // Errors are thrown from resume
+        lua::Coroutine coroutine(state["failing"]);
+        coroutine.resume();
+
+        bool thrown = false;
+        try {
+            coroutine.resume();
+        } catch (lua::RuntimeError& ex) {
+            thrown = strstr(ex.what(), "session failed") != nullptr;
+        }
+        assert(thrown);
+        assert(coroutine.getStatus() == lua::Coroutine::Status::Failed);
+    }
+
+    {   // Tables returned by coroutine can be read and passed to state
+        lua::Coroutine coroutine(state["session"]);
+        assert(coroutine.resume(7).toString() == std::string("ready"));
+
+        lua::Value result = coroutine.resume("request");
+        assert(result["id"].toInt() == 7);
+        assert(result["request"].toString() == std::string("request"));
+
+        state.set("result", result);
+        assert(state["result"]["id"].toInt() == 7);
+
+        lua::Coroutine moved(std::move(coroutine));
+        assert(!coroutine.isInitialized());
+        assert(moved.getStatus() == lua::Coroutine::Status::Finished);
+    }
+
+    {   // Many suspended coroutines are cheap
+        const int Count = 1000;
+        std::size_t memoryBefore = state.getMemoryUsage();
+
+        std::vector<lua::Coroutine> sessions;
+        sessions.reserve(Count);
+        for (int i = 0; i < Count; ++i)
+        {
+            sessions.emplace_back(state["session"]);
+            assert(sessions.back().resume(i).toString() == std::string("ready"));
+        }
+        assert((state.getMemoryUsage() - memoryBefore) / Count < 4096);
+
+        for (int i = Count - 1; i >= 0; --i)
+        {
+            lua::Value result = sessions[i].resume(i * 2);
+            assert(result["id"].toInt() == i);
+            assert(result["request"].toInt() == i * 2);
+        }
+    }
+
+    state.checkMemLeaks();
+    return 0;
+}
@@ -0,0 +1,128 @@
+//
+//  factory_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+#include "../include/LuaStateFactory.h"
+#include "../include/LuaStatePool.h"
+
+#include <functional>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static int add(lua_State* luaState)
+{
+    lua_pushinteger(luaState, luaL_checkinteger(luaState, 1) + luaL_checkinteger(luaState, 2));
+    return 1;
+}
+
+static int twice(lua_State* luaState)
+{
+    lua_pushinteger(luaState, 2 * luaL_checkinteger(luaState, 1));
+    return 1;
+}
+
+static int negate(lua_State* luaState)
+{
+    lua_pushinteger(luaState, -luaL_checkinteger(luaState, 1));
+    return 1;
+}
+
+static const luaL_Reg functions[] = {
+    { "twice", &twice },
+    { "negate", &negate },
+    { nullptr, nullptr }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    lua::StateFactory factory;
+    factory.addFunction("add", &add);
+    factory.addFunctions(functions);
+    factory.addScript("counter = add(1, 2)\n"
+                      "function next() counter = counter + 1; return counter end\n", "=counter");
+    factory.addScript("limit = twice(negate(counter))");
+
+    assert(factory.getFunctionCount() == 3);
+    assert(factory.getScriptCount() == 2);
+
+    bool thrown = false;
+    try {
+        factory.addScript("this is not lua");
+    } catch (lua::LoadError& ex) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(factory.getScriptCount() == 2);
+
+    {   // States are independent
+        std::unique_ptr<lua::State> first = factory.create();
+        std::unique_ptr<lua::State> second = factory.create();
+
+        assert((*first)["counter"].toInt() == 3);
+        assert((*first)["limit"].toInt() == -6);
+        assert((*first)["next"]().toInt() == 4);
+        assert((*first)["next"]().toInt() == 5);
+        assert((*second)["next"]().toInt() == 4);
+        assert((*second)["add"](2, 3).toInt() == 5);
+
+        // Standard libraries are opened
+        assert((*first)["string"].is<lua::Table>());
+
+        first->checkMemLeaks();
+        second->checkMemLeaks();
+    }
+
+    lua::StateFactory::Statistics statistics = factory.getStatistics();
+    assert(statistics.created == 2);
+    assert(statistics.lastLatency.count() > 0);
+    assert(statistics.maxLatency >= statistics.lastLatency);
+    assert(statistics.totalLatency >= statistics.maxLatency);
+    assert(statistics.averageLatency() <= statistics.maxLatency);
+
+    {   // Factory can initialize states of pool
+        lua::StatePool pool(2, std::bind(&lua::StateFactory::initialize, &factory, std::placeholders::_1));
+        lua::StatePool::Lease lease = pool.acquire();
+        assert((*lease)["next"]().toInt() == 4);
+        assert(factory.getStatistics().created == 4);
+    }
+
+    {   // Failing init script is reported when state is created
+        lua::StateFactory failing;
+        failing.addScript("error('init failed')");
+        thrown = false;
+        try {
+            failing.create();
+        } catch (lua::RuntimeError& ex) {
+            thrown = strstr(ex.what(), "init failed") != nullptr;
+        }
+        assert(thrown);
+        assert(failing.getStatistics().created == 0);
+    }
+
+    {   // Registration in state without free memory is reported as error
+        lua::StateFactory many;
+        for (int index = 0; index < 100; ++index)
+            many.addFunction("function" + std::to_string(index), &add);
+
+        lua::State limited;
+        limited.setMemoryLimit(limited.getMemoryUsage() + 64);
+        thrown = false;
+        try {
+            many.initialize(limited);
+        } catch (lua::MemoryLimitError& ex) {
+            thrown = true;
+        }
+        assert(thrown);
+        limited.setMemoryLimit(0);
+    }
+
+    lua::State state;
+    factory.initialize(state);
+    assert(state["limit"].toInt() == -6);
+
+    state.checkMemLeaks();
+    return 0;
+}
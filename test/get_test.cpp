@@ -110,6 +110,20 @@ int main(int argc, char** argv)
     else
         assert(false);
     
+    // Interned keys
+    lua::Key tableKey = state.createKey("table");
+    lua::Key aKey = state.createKey("a");
+    assert(aKey.toString() == "a");
+    assert(state[tableKey][aKey].toCStr()[0] == 'a');
+    assert(state["nested"]["table"][aKey].toCStr()[0] == 'a');
+    
+    lua::Key copiedKey = aKey;
+    assert(state[tableKey][copiedKey].toCStr()[0] == 'a');
+    assert(state[state.createKey("missing")].isNil());
+    
+    lua::Key zeroKey = state.createKey(std::string("a\0b", 3));
+    assert(zeroKey.toString().length() == 3);
+    
     state.checkMemLeaks();
     
     return 0;
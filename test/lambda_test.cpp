@@ -35,6 +35,28 @@ struct Resource {
 };
 int Resource::refCounter = 0;
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+/// Number of allocations made with global operator new
+static int heapAllocations = 0;
+
+void* operator new(std::size_t size)
+{
+    ++heapAllocations;
+    if (void* memory = std::malloc(size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 struct Foo {
     int a; int b;
@@ -254,6 +276,50 @@ int main(int argc, char** argv)
         assert(value.is<lua::Nil>());
     }
     
+    {   // Arguments are read directly from stack without heap allocations
+        int allocations = -1;
+        state.set("add4", [&](int a, lua::Integer b, double c, const char* d) {
+            allocations = heapAllocations;
+            return a + b + static_cast<lua::Integer>(c) + static_cast<lua::Integer>(strlen(d));
+        });
+        
+        // First call will fill pool of stack items
+        assert(state["add4"](1, 2, 3.0, "four").toInt() == 10);
+        
+        int before = heapAllocations;
+        assert(state["add4"](1, 2, 3.0, "four").toInt() == 10);
+        assert(allocations == before);
+        assert(heapAllocations == before);
+    }
+    
+    {   // Tied values mixing lua::Value and other types release their stack slots
+        int intValue = 0;
+        lua::Value value;
+        lua::String text = nullptr;
+        lua::tie(intValue, value, text) = state.doString("return 1, 2, 'three', 4");
+        assert(intValue == 1);
+        assert(value.toInt() == 2);
+        assert(strcmp(text, "three") == 0);
+        
+        lua::tie(value, intValue) = state.doString("return 5, 6");
+        assert(value.toInt() == 5);
+        assert(intValue == 6);
+    }
+    
+    {   // Functors pushed by user code with "luaL_Functor" metatable still work
+        lua_State* luaState = state.getState();
+        lua::BaseFunctor** functor = static_cast<lua::BaseFunctor**>(lua_newuserdata(luaState, sizeof(lua::BaseFunctor*)));
+        *functor = new lua::Functor<int, int, int>([](int a, int b) { return a * b; });
+        luaL_setmetatable(luaState, "luaL_Functor");
+        lua_setglobal(luaState, "multiply");
+        assert(state.doString("return multiply(6, 7)").toInt() == 42);
+        
+        std::function<int(int)> twice = [](int a) { return a * 2; };
+        state.set("twice", twice);
+        assert(state.doString("return twice(21)").toInt() == 42);
+        state.doString("multiply = nil; collectgarbage()");
+    }
+    
     state.checkMemLeaks();
     return 0;
 }
@@ -43,6 +43,18 @@ int main(int argc, char** argv)
     runTest("state_test");
     runTest("types_test");
     runTest("values_test");
+    runTest("alloc_test");
+    runTest("container_test");
+    runTest("struct_test");
+    runTest("class_test");
+    runTest("pool_test");
+    runTest("factory_test");
+    runTest("channel_test");
+    runTest("serialize_test");
+    runTest("coroutine_test");
+    runTest("async_test");
+    runTest("budget_test");
+    runTest("profiler_test");
     
     return 0;
 }
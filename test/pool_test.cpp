@@ -0,0 +1,151 @@
+//
+//  pool_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+#include "../include/LuaStatePool.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    std::atomic<int> initialized(0);
+
+    lua::StatePool pool(2, [&](lua::State& state) {
+        state.set("multiply", [](int a, int b) { return a * b; });
+        state.doString("base = 10\n"
+                       "config = { value = 1 }\n");
+        ++initialized;
+    });
+
+    assert(pool.size() == 2);
+    assert(pool.available() == 2);
+    assert(initialized == 2);
+
+    {   // Globals are reset when lease is returned
+        lua::StatePool::Lease lease = pool.acquire();
+        assert(lease.isValid());
+        assert(pool.available() == 1);
+
+        lease->doString("temporary = 5\n"
+                        "base = multiply(base, 2)\n"
+                        "multiply = nil\n");
+        assert((*lease)["base"].toInt() == 20);
+        assert((*lease)["temporary"].toInt() == 5);
+
+        lua::State* state = &*lease;
+        lease.release();
+        assert(!lease.isValid());
+        assert(pool.available() == 2);
+
+        // Last returned state is leased first, because it is still in cache
+        lease = pool.acquire();
+        assert(&*lease == state);
+        assert((*lease)["base"].toInt() == 10);
+        assert((*lease)["temporary"].isNil());
+        assert((*lease)["multiply"](3, 4).toInt() == 12);
+    }
+    assert(pool.available() == 2);
+
+    {   // Acquiring without waiting returns empty lease when pool is exhausted
+        lua::StatePool::Lease first = pool.tryAcquire();
+        lua::StatePool::Lease second = pool.tryAcquire();
+        lua::StatePool::Lease third = pool.tryAcquire();
+        assert(first && second);
+        assert(!third);
+        assert(first.getIndex() != second.getIndex());
+
+        third = std::move(first);
+        assert(third && !first);
+        assert(pool.available() == 0);
+    }
+    assert(pool.available() == 2);
+
+    {   // Workers share states without creating new ones
+        std::atomic<int> calls(0);
+        std::vector<std::thread> workers;
+        for (int worker = 0; worker < 4; ++worker)
+        {
+            workers.emplace_back([&]() {
+                for (int i = 0; i < 100; ++i)
+                {
+                    lua::StatePool::Lease lease = pool.acquire();
+                    lease->doString("counter = (counter or 0) + 1");
+                    assert((*lease)["counter"].toInt() == 1);
+                    ++calls;
+                }
+            });
+        }
+        for (std::thread& worker : workers)
+            worker.join();
+
+        assert(calls == 400);
+        assert(initialized == 2);
+        assert(pool.available() == 2);
+    }
+
+    {   // Pinned threads run on CPU with index of their state and their affinity is restored on release
+#ifdef __linux__
+        cpu_set_t before;
+        pthread_getaffinity_np(pthread_self(), sizeof(before), &before);
+#endif
+        lua::StatePool pinned(1, nullptr, true);
+        lua::StatePool::Lease lease = pinned.acquire();
+        assert(lease.getIndex() == 0);
+        lease->checkMemLeaks();
+#ifdef __linux__
+        assert(lease.isPinned());
+        cpu_set_t during;
+        pthread_getaffinity_np(pthread_self(), sizeof(during), &during);
+        assert(CPU_COUNT(&during) == 1);
+
+        lease.release();
+        cpu_set_t after;
+        pthread_getaffinity_np(pthread_self(), sizeof(after), &after);
+        assert(CPU_EQUAL(&before, &after));
+#endif
+    }
+
+    {   // Globals are restored even when leased state reached its memory limit
+        lua::StatePool limited(1, [](lua::State& state) {
+            state.doString("for i = 1, 200 do _G['global' .. i] = i end");
+        });
+        {
+            lua::StatePool::Lease lease = limited.acquire();
+            lease->doString("for i = 1, 200 do _G['global' .. i] = nil end; for i = 1, 200 do _G['other' .. i] = i end; for i = 1, 200 do _G['other' .. i] = nil end; collectgarbage()");
+            lease->setMemoryLimit(lease->getMemoryUsage());
+            lease.release();
+        }
+        lua::StatePool::Lease lease = limited.acquire();
+        assert(lease->doString("return global200").toInt() == 200);
+        assert(lease->getMemoryLimit() == 0);
+    }
+
+    {   // Memory limit, budget and profiler set by lease don't leak to next lease
+        lua::StatePool configured(1, [](lua::State& state) {
+            state.setMemoryLimit(8 * 1024 * 1024);
+        });
+        {
+            lua::StatePool::Lease lease = configured.acquire();
+            lease->setMemoryLimit(lease->getMemoryUsage() + 64 * 1024);
+            lease->setExecutionBudget(lua::ExecutionBudget(1000));
+            lease->startProfiler(100);
+            lease->doString("local sum = 0; for i = 1, 100 do sum = sum + i end");
+        }
+        lua::StatePool::Lease lease = configured.acquire();
+        assert(lease->getMemoryLimit() == 8 * 1024 * 1024);
+        assert(!lease->getExecutionBudget().isLimited());
+        assert(!lease->getProfiler()->isRunning());
+        assert(lease->getProfiler()->getSampleCount() == 0);
+        assert(lua_gethook(lease->getState()) == nullptr);
+    }
+
+    lua::StatePool::Lease lease = pool.acquire();
+    lease->checkMemLeaks();
+    return 0;
+}
@@ -0,0 +1,206 @@
+//
+//  profiler_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+
+#include <chrono>
+#include <set>
+#include <sstream>
+#include <thread>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+struct Sleeper
+{
+    void nap(int milliseconds)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static std::string folded(lua::State& state)
+{
+    std::ostringstream output;
+    state.getProfiler()->writeFolded(output);
+    return output.str();
+}
+
+/// @return Sum of times in folded output in microseconds
+static long long total(const std::string& output)
+{
+    std::istringstream lines(output);
+    std::string line;
+    long long sum = 0;
+    while (std::getline(lines, line))
+        sum += std::stoll(line.substr(line.rfind(' ') + 1));
+    return sum;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    lua::State state;
+    state.set("wait", [](int milliseconds) { std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds)); });
+    state.doString("function count(n) local sum = 0; for i = 1, n do sum = sum + i end; return sum end\n"
+                   "function work() count(2000000); wait(20) end");
+
+    {   // Profiler isn't created until it is started
+        assert(state.getProfiler() == nullptr);
+        assert(lua_gethook(state.getState()) == nullptr);
+    }
+
+    {   // Samples are aggregated into call tree with Lua functions and bound C++ functions
+        state.startProfiler(1000);
+        assert(state.getProfiler()->isRunning());
+        state.doString("work()");
+        state.stopProfiler();
+        assert(lua_gethook(state.getState()) == nullptr);
+        assert(state.getProfiler()->getSampleCount() > 100);
+
+        std::string output = folded(state);
+        assert(output.find("main ([string \"work()\"]:0);work (") == 0);
+        assert(output.find(":2);count (") != std::string::npos);
+        assert(output.find(":2);wait [C] ") != std::string::npos);
+
+        // Every line is path of frames followed by time in microseconds
+        std::istringstream lines(output);
+        std::string line;
+        long long waited = 0;
+        while (std::getline(lines, line))
+        {
+            std::size_t separator = line.rfind(' ');
+            assert(separator != std::string::npos && separator + 1 < line.size());
+            long long microseconds = std::stoll(line.substr(separator + 1));
+            assert(microseconds > 0);
+            if (line.find("wait [C]") != std::string::npos)
+                waited += microseconds;
+        }
+        assert(waited >= 20000);
+    }
+
+    {   // Stopped profiler keeps samples until they are cleared
+        std::size_t samples = state.getProfiler()->getSampleCount();
+        state.doString("work()");
+        assert(state.getProfiler()->getSampleCount() == samples);
+
+        state.getProfiler()->clear();
+        assert(state.getProfiler()->getSampleCount() == 0);
+        assert(folded(state).empty());
+    }
+
+    {   // Time between calls isn't attributed, also when they are unprotected
+        state.startProfiler(1000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        assert(state["count"](100000).toInt() == 5000050000LL);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        assert(state["count"](100000).toInt() == 5000050000LL);
+        state.stopProfiler();
+
+        assert(state.getProfiler()->getSampleCount() > 0);
+        assert(total(folded(state)) < 50000);
+        state.getProfiler()->clear();
+    }
+
+    {   // Methods of bound classes are attributed by name and results can fill whole stack of C function
+        state.defineClass<Sleeper>("Sleeper")
+            .constructor<>()
+            .method("nap", &Sleeper::nap);
+        state.set("many", []() { return std::make_tuple(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20); });
+
+        state.startProfiler(1000);
+        state.doString("local sleeper = Sleeper.new(); sleeper:nap(10)");
+        assert(state.doString("local sum = 0; for i = 1, 100 do sum = sum + select(20, many()) end; return sum").toInt() == 2000);
+        state.stopProfiler();
+
+        std::string output = folded(state);
+        assert(output.find(";nap [C] ") != std::string::npos);
+        state.getProfiler()->clear();
+    }
+
+    {   // Short calls are summed under calling function, also those made after last sample
+        state.set("add", [](int a, int b) { return a + b; });
+        state.doString("function loop(n) local sum = 0; for i = 1, n do sum = add(sum, 1) end; return sum end");
+
+        state.startProfiler(1000);
+        assert(state["loop"](100000).toInt() == 100000);
+        assert(state["add"](1, 2).toInt() == 3);
+        state.stopProfiler();
+
+        std::string output = folded(state);
+        assert(output.find("\nadd [C] ") == std::string::npos && output.find("add [C] ") != 0);
+        assert(output.find(":1);add [C] ") != std::string::npos);
+        state.getProfiler()->clear();
+    }
+
+    {   // Lua functions are identified by content of chunk source, which is not interned by Lua when it is long
+        std::string padding(200, '-');
+        std::string one = "-- one" + padding + "\nlocal function spin() for i = 1, 20000 do end end; for i = 1, 5 do spin() end";
+        std::string two = "-- two" + padding + "\nlocal function turn() for i = 1, 20000 do end end; for i = 1, 5 do turn() end";
+
+        // Source of collected chunk can be freed and its memory reused by next chunk
+        state.startProfiler(100);
+        for (int i = 0; i < 20; ++i)
+        {
+            state.doString(one);
+            state.doString("collectgarbage()");
+            state.doString(two);
+            state.doString("collectgarbage()");
+        }
+        state.stopProfiler();
+
+        // Each stack is written only once and functions from different chunks aren't merged
+        std::string output = folded(state);
+        assert(output.find("spin (") != std::string::npos && output.find("turn (") != std::string::npos);
+
+        std::istringstream lines(output);
+        std::set<std::string> stacks;
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            std::string stack = line.substr(0, line.rfind(' '));
+            assert(stacks.insert(stack).second);
+            assert(stack.find("spin (") == std::string::npos || stack.find("-- one") != std::string::npos);
+            assert(stack.find("turn (") == std::string::npos || stack.find("-- two") != std::string::npos);
+        }
+        state.getProfiler()->clear();
+    }
+
+    {   // Profiler shares count hook with execution budget
+        state.setExecutionBudget(lua::ExecutionBudget(100000));
+        state.startProfiler(500);
+
+        bool thrown = false;
+        try {
+            state.doString("count(1000000)");
+        } catch (lua::ExecutionLimitError& ex) {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(state["count"].call(1000).toInt() == 500500);
+        assert(folded(state).find("count (") != std::string::npos);
+
+        // Removing budget keeps hook of profiler and stopping profiler keeps hook of budget
+        state.setExecutionBudget(lua::ExecutionBudget());
+        assert(lua_gethook(state.getState()) != nullptr);
+        state.setExecutionBudget(lua::ExecutionBudget(100000));
+        state.stopProfiler();
+        assert(lua_gethook(state.getState()) != nullptr);
+
+        thrown = false;
+        try {
+            state.doString("count(1000000)");
+        } catch (lua::ExecutionLimitError& ex) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        state.setExecutionBudget(lua::ExecutionBudget());
+        assert(lua_gethook(state.getState()) == nullptr);
+    }
+
+    state.checkMemLeaks();
+    return 0;
+}
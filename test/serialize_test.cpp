@@ -0,0 +1,117 @@
+//
+//  serialize_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+#include "../include/LuaSerializer.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    lua::State source;
+    source.doString(createVariables);
+
+    lua::State target;
+
+    {   // Simple values
+        assert(lua::deserialize(target, lua::serialize(source["integer"])).toInt() == 10);
+        assert(lua::deserialize(target, lua::serialize(source["number"])).toNumber() == 2.5);
+        assert(lua::deserialize(target, lua::serialize(source["text"])).toString() == std::string("hello"));
+        assert(lua::deserialize(target, lua::serialize(source["boolean"])).toBool() == true);
+        assert(lua::deserialize(target, lua::serialize(source["missing"])).isNil());
+
+        source.doString("binary = 'zero\\0inside'");
+        assert(lua::deserialize(target, lua::serialize(source["binary"])).toString() == std::string("zero\0inside", 11));
+    }
+
+    {   // Cyclic table keeps its identity
+        lua::Value nested = lua::deserialize(target, lua::serialize(source["nested"]));
+        assert(nested["table"][1].toInt() == 100);
+        assert(nested["table"]["three"].toInt() == 3);
+        assert(nested["nested"]["nested"]["table"][2].toString() == std::string("hello"));
+
+        target.set("nested", nested);
+        assert(target.doString("return nested.nested == nested").toBool());
+    }
+
+    {   // Shared tables are not duplicated
+        source.doString("shared = { 1, 2, 3 }; pair = { first = shared, second = shared, [shared] = 'key' }");
+        target.set("pair", lua::deserialize(target, lua::serialize(source["pair"])));
+        assert(target.doString("return pair.first == pair.second and pair[pair.first] == 'key'").toBool());
+        assert(target.doString("return pair.second[3]").toInt() == 3);
+    }
+
+    {   // Repeated strings are stored only once
+        source.doString("single = { 'some long string value' }; repeated = { 'some long string value', 'some long string value', 'some long string value' }");
+        std::size_t single = lua::serialize(source["single"]).size();
+        std::size_t repeated = lua::serialize(source["repeated"]).size();
+        assert(repeated < single + 10);
+
+        lua::Value value = lua::deserialize(target, lua::serialize(source["repeated"]));
+        assert(value[3].toString() == std::string("some long string value"));
+    }
+
+    {   // Records can be read one after another from one stream
+        std::string stream;
+        lua::serialize(source["integer"], stream);
+        lua::serialize(source["table"], stream);
+        lua::serialize(source["text"], stream);
+
+        const char* data = stream.data();
+        std::size_t length = stream.size();
+        std::size_t consumed = 0;
+
+        assert(lua::deserialize(target, data, length, &consumed).toInt() == 10);
+        data += consumed;
+        length -= consumed;
+
+        lua::Value table = lua::deserialize(target, data, length, &consumed);
+        assert(table["a"].toString() == std::string("a"));
+        assert(table.length() == 3);
+        data += consumed;
+        length -= consumed;
+
+        assert(lua::deserialize(target, data, length, &consumed).toString() == std::string("hello"));
+        assert(consumed == length);
+    }
+
+    {   // Functions can't be serialized and malformed data are rejected
+        bool thrown = false;
+        try {
+            lua::serialize(source["table"]["missing"]);
+            lua::serialize(source["print"]);
+        } catch (lua::SerializationError& ex) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        std::string data = lua::serialize(source["table"]);
+        for (std::size_t length = 0; length < data.size(); ++length)
+        {
+            thrown = false;
+            try {
+                lua::deserialize(target, data.data(), length);
+            } catch (lua::SerializationError& ex) {
+                thrown = true;
+            }
+            assert(thrown);
+        }
+
+        thrown = false;
+        try {
+            lua::deserialize(target, "not serialized");
+        } catch (lua::SerializationError& ex) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    assert(lua_gettop(source.getState()) == 0);
+    assert(lua_gettop(target.getState()) == 0);
+
+    source.checkMemLeaks();
+    target.checkMemLeaks();
+    return 0;
+}
@@ -46,6 +46,46 @@ int main(int argc, char** argv)
         state.doString("assert(tab[3] == 3)");
     }
     
+    // Presized tables and batch sets
+    {
+        state.set("big", lua::Table(10000, 2));
+        lua::Value big = state["big"];
+        for (int i = 1; i <= 10000; ++i)
+            big.setMany(i, i * 2);
+        big.setMany("name", "big", "size", 10000);
+        state.doString("assert(#big == 10000 and big[10000] == 20000 and big.name == 'big' and big.size == 10000)");
+        
+        // Batch sets don't invoke metamethods
+        state.doString("guarded = setmetatable({}, { __newindex = function() error('metamethod') end })");
+        state["guarded"].setMany(1, "a", "key", true, 2.5, "number");
+        state.doString("assert(rawget(guarded, 1) == 'a' and rawget(guarded, 'key') == true and rawget(guarded, 2.5) == 'number')");
+        
+        std::vector<std::string> letters = { "x", "y", "z" };
+        state.set("appended", lua::Table(3));
+        state["appended"].setRange(letters.begin(), letters.end());
+        state["appended"].setRange(letters.begin(), letters.begin() + 1);
+        state.doString("assert(#appended == 4 and appended[3] == 'z' and appended[4] == 'x')");
+        
+        std::map<std::string, int> pairs = { { "one", 1 }, { "two", 2 } };
+        state.set("nestedBatch", lua::Table());
+        state["nestedBatch"].set("inner", lua::Table(0, 2));
+        state["nestedBatch"]["inner"].setRange(pairs.begin(), pairs.end());
+        state["nestedBatch"]["inner"].setMany("three", 3);
+        state.doString("assert(nestedBatch.inner.one == 1 and nestedBatch.inner.two == 2 and nestedBatch.inner.three == 3)");
+    }
+    
+    // Set values with interned keys
+    {
+        lua::Key tabKey = state.createKey("tab");
+        lua::Key valueKey = state.createKey("value");
+        state[tabKey].set(valueKey, 42);
+        state.doString("assert(tab.value == 42)");
+        state.set(valueKey, "global");
+        state.doString("assert(value == 'global')");
+        state.set(tabKey, valueKey);
+        state.doString("assert(tab == 'value')");
+    }
+    
     state.checkMemLeaks();
     return 0;
 }
@@ -78,7 +78,99 @@ int main(int argc, char** argv)
     assert(a1 == 11);
     lua::tie(a1, a2, a3) = state.doFile("test.lua");
     assert(a1 == 11 && a2 == 12 && a3 == 13);
-    
+
+    // Check cached compilation of files
+    state.setChunkCacheDirectory(".");
+    std::string entryPath = state.getChunkCache()->getEntryPath("test.lua");
+    std::remove(entryPath.c_str());
+
+    assert(state.doFile("test.lua").toInt() == 11);
+    std::ifstream entry(entryPath, std::ios::binary);
+    assert(entry.good());
+    entry.close();
+    assert(state.doFile("test.lua").toInt() == 11);
+
+    // Different names of same file share entry
+    assert(state.getChunkCache()->getEntryPath("./test.lua") == entryPath);
+    assert(state.doFile("./test.lua").toInt() == 11);
+
+    // Modified file is compiled again
+    luaFile.open("test.lua");
+    luaFile << "return 'modified', 2" << std::endl;
+    luaFile.close();
+    lua::tie(a1, a2) = state.doFile("test.lua");
+    assert(a2 == 2);
+    assert(state.doFile("test.lua").toString() == "modified");
+
+    // Corrupt entry is replaced
+    std::ofstream corrupt(entryPath, std::ios::binary | std::ios::trunc);
+    corrupt << "corrupt";
+    corrupt.close();
+    assert(state.doFile("test.lua").toString() == "modified");
+    assert(state.doFile("test.lua").toString() == "modified");
+
+    // Chunk name is canonical path, also when chunk is loaded from cache
+    luaFile.open("test.lua");
+    luaFile << "return debug.getinfo(1, 'S').source" << std::endl;
+    luaFile.close();
+    std::string compiledName = state.doFile("test.lua").toString();
+    assert(state.doFile("./test.lua").toString() == compiledName);
+    assert(compiledName != "@test.lua" && compiledName.find("test.lua") != std::string::npos);
+
+    // Errors are reported same way as without cache
+    try {
+        state.doFile("no_file_here");
+        assert(false);
+    } catch (lua::LoadError ex) {
+        printf("%s\n", ex.what());
+    }
+
+    std::remove(entryPath.c_str());
+    state.setChunkCacheDirectory("");
+    assert(state.getChunkCache() == nullptr);
+
+    // Check compiled chunks
+    lua::Chunk chunk = state.compile("local a, b = ...; counter = (counter or 0) + 1; return a + b, counter");
+    assert(chunk.isInitialized());
+    lua::tie(a1, a2) = chunk(1, 2);
+    assert(a1 == 3 && a2 == 1);
+    lua::tie(a1, a2) = chunk.call(10, 20);
+    assert(a1 == 30 && a2 == 2);
+    assert(chunk(5, 5).toInt() == 10);
+
+    // Source doesn't need to be zero terminated
+    const char buffer[] = { 'r', 'e', 't', 'u', 'r', 'n', ' ', '4', '2', 'x' };
+    assert(state.compile(buffer, 9)().toInt() == 42);
+
+    lua::Chunk moved = std::move(chunk);
+    assert(!chunk.isInitialized());
+    assert(moved(1, 1).toInt() == 2);
+
+    // Chunk can be stored as Lua function
+    state.set("compiled", moved);
+    assert(state.doString("return compiled(2, 3)").toInt() == 5);
+
+    try {
+        state.compile("we will invoke syntax error", "=rules");
+        assert(false);
+    } catch (lua::LoadError ex) {
+        printf("%s\n", ex.what());
+        assert(std::string(ex.what()).compare(0, 6, "rules:") == 0);
+    }
+
+    lua::Chunk failing = state.compile("error('failed')");
+    try {
+        failing();
+        assert(false);
+    } catch (lua::RuntimeError ex) {
+        printf("%s\n", ex.what());
+    }
+
+#if LUA_VERSION_NUM >= 504
+    // Warnings are off by default and they can be switched on by script
+    state.doString("warn('hidden'); warn('@on'); warn('visible ', 'warning'); warn('@off'); warn('hidden')");
+#endif
+
     state.checkMemLeaks();
     return 0;
 }
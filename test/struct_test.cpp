@@ -0,0 +1,107 @@
+//
+//  struct_test.cpp
+//  LuaState
+//
+//  See LICENSE and README.md files
+
+#include "test.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+struct Point
+{
+    double x = 0;
+    double y = 0;
+};
+
+struct Shape
+{
+    std::string name;
+    int layer = 0;
+    bool visible = true;
+    Point origin;
+    std::vector<Point> points;
+};
+
+namespace lua { namespace traits {
+    
+    template<>
+    struct ValueTraits<Point> : StructTraits<Point>
+    {
+        template<typename Visitor>
+        static void fields(Visitor& visitor)
+        {
+            visitor("x", &Point::x);
+            visitor("y", &Point::y);
+        }
+    };
+    
+    template<>
+    struct ValueTraits<Shape> : StructTraits<Shape>
+    {
+        template<typename Visitor>
+        static void fields(Visitor& visitor)
+        {
+            visitor("name", &Shape::name);
+            visitor("layer", &Shape::layer);
+            visitor("visible", &Shape::visible);
+            visitor("origin", &Shape::origin);
+            visitor("points", &Shape::points);
+        }
+    };
+}}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+    lua::State state;
+    
+    // Reading
+    state.doString("point = { x = 1.5, y = -2 }");
+    Point point = state["point"].to<Point>();
+    assert(point.x == 1.5 && point.y == -2);
+    assert(state["point"].is<Point>());
+    
+    state.doString("shape = { name = 'triangle', layer = 3, origin = { x = 1, y = 1 }, points = { { x = 0, y = 0 }, { x = 1, y = 0 }, { x = 0, y = 1 } } }");
+    Shape shape = state["shape"].to<Shape>();
+    assert(shape.name == "triangle");
+    assert(shape.layer == 3);
+    assert(shape.visible == true);
+    assert(shape.origin.x == 1 && shape.origin.y == 1);
+    assert(shape.points.size() == 3 && shape.points[1].x == 1 && shape.points[2].y == 1);
+    
+    // Wrong field types are detected
+    state.doString("wrong = { x = 'text' }");
+    assert(!state["wrong"].is<Point>());
+    assert(!state["nothing"].is<Point>());
+    assert(state["nothing"].to<Point>().x == 0);
+    
+    // Pushing
+    shape.name = "square";
+    shape.visible = false;
+    shape.points.push_back(Point());
+    state.set("pushed", shape);
+    state.doString("assert(pushed.name == 'square' and pushed.layer == 3 and pushed.visible == false)");
+    state.doString("assert(pushed.origin.x == 1 and #pushed.points == 4 and pushed.points[2].x == 1)");
+    
+    // Round trip through Lua
+    Shape copy = state["pushed"].to<Shape>();
+    assert(copy.name == "square" && copy.points.size() == 4 && copy.origin.y == 1);
+    
+    // Bound functions
+    state.set("length", std::function<double(Point)>([](Point p) { return p.x * p.x + p.y * p.y; }));
+    state.doString("assert(length({ x = 3, y = 4 }) == 25)");
+    
+    state.set("center", std::function<Point(Shape)>([](Shape s) {
+        Point center;
+        for (const Point& p : s.points)
+        {
+            center.x += p.x / s.points.size();
+            center.y += p.y / s.points.size();
+        }
+        return center;
+    }));
+    state.doString("local c = center({ points = { { x = 0, y = 0 }, { x = 2, y = 4 } } }); assert(c.x == 1 and c.y == 2)");
+    
+    state.checkMemLeaks();
+    return 0;
+}
@@ -82,6 +82,52 @@ int main(int argc, char** argv)
     state.setData("binary", binaryData, 3);
     assert(std::strcmp(state["binary"].toCStr(), "abc") == 0);
     
+    // Strings with embedded zeros
+    const std::string zeroString("a\0b\0c", 5);
+    state.set("value", zeroString);
+    assert(state["value"].toString() == zeroString);
+    assert(state["value"].length() == 5);
+    state.doString("assert(value == 'a\\0b\\0c')");
+    
+    state.set("value", std::string());
+    assert(state["value"].toString().empty());
+    
+    state.doString("zeroKeys = { ['a\\0b'] = 1, a = 2 }");
+    assert(state["zeroKeys"][std::string("a\0b", 3)].toInt() == 1);
+    assert(state["zeroKeys"][std::string("a")].toInt() == 2);
+    
+    state.setData("binary", "x\0y", 3);
+    std::string binaryString;
+    assert(state["binary"].getString(binaryString));
+    assert(binaryString == std::string("x\0y", 3));
+    
+#ifdef LUASTATE_CXX17
+    std::string_view view = state["value"].to<std::string_view>();
+    assert(view.empty());
+    state.set("value", std::string_view("d\0e", 3));
+    view = state["value"].to<std::string_view>();
+    assert(view == std::string_view("d\0e", 3));
+    assert(state["value"].is<std::string_view>());
+    assert(!state["integer"].is<std::string_view>());
+#endif
+    
+#ifdef LUASTATE_CXX20
+    const unsigned char bytes[] = { 0x00, 0xff, 0x10 };
+    state.set("value", std::span<const unsigned char>(bytes, 3));
+    assert(state["value"].toString() == std::string("\0\xff\x10", 3));
+    assert(state["value"].is<std::span<const unsigned char>>());
+    
+    std::span<const std::byte> byteSpan = state["value"].to<std::span<const std::byte>>();
+    assert(byteSpan.size() == 3 && byteSpan[1] == std::byte(0xff));
+    
+    std::span<const char> charSpan = state["value"].to<std::span<const char>>();
+    assert(charSpan.size() == 3 && charSpan[2] == '\x10');
+    assert(!state["integer"].is<std::span<const char>>());
+    
+    state.set("value", std::span<const char>());
+    assert(state["value"].toString() == std::string());
+#endif
+    
     state.checkMemLeaks();
     return 0;
 }
@@ -7,6 +7,7 @@
 //  See LICENSE and README.md files
 
 #include "test.h"
+#include "../include/LuaCoroutine.h"
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 int main(int argc, char** argv)
@@ -210,6 +211,55 @@ int main(int argc, char** argv)
     state["moveValues"](*v1);
     delete v1;
     
+    // Chained lookups are lazy and take one stack slot
+    {
+        lua::Value nested = state["nested"];
+        int stackTop = lua_gettop(state.getState());
+        
+        auto path = nested["nested"]["table"]["a"];
+        assert(lua_gettop(state.getState()) == stackTop);
+        assert(path.toString() == "a");
+        assert(path.is<std::string>());
+        assert(!path.isNil());
+        assert(nested["nested"]["table"][1].toInt() == 100);
+        assert(nested["table"].length() == 3);
+        assert(lua_gettop(state.getState()) == stackTop);
+        
+        nested["nested"]["table"].set("d", "d");
+        nested["nested"]["nested"]["table"].setString("e", "e");
+        state.doString("assert(table.d == 'd' and table.e == 'e')");
+        assert(lua_gettop(state.getState()) == stackTop);
+        
+        // Path converted to lua::Value keeps value in stack
+        lua::Value table = nested["nested"]["table"];
+        assert(lua_gettop(state.getState()) == stackTop + 1);
+        assert(table["b"].toString() == "b");
+        
+        // Path is evaluated again after change
+        state.doString("table.a = 'changed'");
+        assert(path.toString() == "changed");
+        state.doString("table.a = 'a'");
+        
+        // Calling functions and passing paths as arguments
+        state.doString("lib = { math = { add = function(a, b) return a + b end }, values = { 1, 2 } }");
+        lua::Value lib = state["lib"];
+        assert(lib["math"]["add"](1, 2).toInt() == 3);
+        assert(lib["math"]["add"].call(lib["values"][1], lib["values"][2]).toInt() == 3);
+        
+        lua::Key valuesKey = state.createKey("values");
+        assert(lib[valuesKey][2].toInt() == 2);
+        
+        // Path keeps its own copy of key
+        auto second = lib[state.createKey("values")][2];
+        assert(second.toInt() == 2);
+        
+        // Path starting at value in stack of other thread can be passed to calls in main thread
+        state.doString("function yieldLib() coroutine.yield(lib) end");
+        lua::Coroutine coroutine(state["yieldLib"]);
+        lua::Value yielded = coroutine.resume();
+        assert(lib["math"]["add"](yielded["values"][1], yielded["values"][2]).toInt() == 3);
+    }
+    
     state.checkMemLeaks();
     return 0;
 }